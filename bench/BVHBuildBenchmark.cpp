@@ -0,0 +1,99 @@
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <random>
+
+#include "MeshObject.hpp"
+#include "ThreadPool.hpp"
+
+static void RunBenchmark(const std::string& name, const char* ply_filename,
+                         BVHConstructionAlgorithm construction_algorithm,
+                         ThreadPool* thread_pool,
+                         const std::vector<Ray>& rays) {
+  MeshObject mesh(nullptr, ply_filename, Vec3f{0, 0, 0}, IDENTITY_MATRIX,
+                  RawScalingFlip{false, false, false}, construction_algorithm,
+                  BVHLayout::kBest);
+
+  auto start = std::chrono::steady_clock::now();
+  mesh.Preprocess(false, true, true, thread_pool);
+  auto end = std::chrono::steady_clock::now();
+  double build_seconds = std::chrono::duration<double>(end - start).count();
+
+  // The builds differ in the order of the primitives at most, so all of them
+  // find the same hits
+  uint64_t hit_count = 0;
+  double t_sum = 0;
+  start = std::chrono::steady_clock::now();
+  for (const auto& ray : rays) {
+    HitRecord hit;
+    hit.t_ = std::numeric_limits<float>::max();
+    if (mesh.Intersect(ray, hit)) {
+      hit_count++;
+      t_sum += hit.t_;
+    }
+  }
+  end = std::chrono::steady_clock::now();
+  double intersect_seconds = std::chrono::duration<double>(end - start).count();
+
+  std::cout << name << ": build " << build_seconds * 1e3 << " ms, "
+            << mesh.bvh_->nodes_.size() << " nodes, closest hit "
+            << rays.size() / intersect_seconds / 1e6 << " M rays/s, "
+            << hit_count << " hits, t sum " << t_sum << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0]
+              << " <ply_file> <thread_count [OPTIONAL]> <ray_count [OPTIONAL]>"
+              << std::endl;
+    return 1;
+  }
+  int thread_count = argc > 2 ? std::stoi(argv[2]) : 0;
+  int ray_count = argc > 3 ? std::stoi(argv[3]) : 100000;
+
+  // Rays from a sphere around the mesh towards points inside its bounds
+  MeshObject bounds_mesh(nullptr, argv[1], Vec3f{0, 0, 0}, IDENTITY_MATRIX,
+                         RawScalingFlip{false, false, false});
+  bounds_mesh.Preprocess(true, false);
+  Vec3f center = (bounds_mesh.min_point_ + bounds_mesh.max_point_) * 0.5f;
+  Vec3f extent = bounds_mesh.max_point_ - bounds_mesh.min_point_;
+  float radius = norm(extent);
+  std::mt19937 generator(795);
+  std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+  std::vector<Ray> rays;
+  rays.reserve(ray_count);
+  for (int i = 0; i < ray_count; i++) {
+    Vec3f origin = normalize(Vec3f{distribution(generator),
+                                   distribution(generator),
+                                   distribution(generator)}) *
+                       radius +
+                   center;
+    Vec3f target = center + Vec3f{distribution(generator) * extent.x,
+                                  distribution(generator) * extent.y,
+                                  distribution(generator) * extent.z} *
+                                0.5f;
+    rays.push_back(Ray({0, 0}, origin, normalize(target - origin)));
+  }
+
+  ThreadPool thread_pool(thread_count);
+  std::cout << bounds_mesh.TriangleCount() << " triangles, "
+            << thread_pool.Size() << " threads" << std::endl;
+  RunBenchmark("Median serial", argv[1], BVHConstructionAlgorithm::kMedian,
+               nullptr, rays);
+  RunBenchmark("Median parallel", argv[1], BVHConstructionAlgorithm::kMedian,
+               &thread_pool, rays);
+  RunBenchmark("SAH serial", argv[1], BVHConstructionAlgorithm::kSAH, nullptr,
+               rays);
+  RunBenchmark("SAH parallel", argv[1], BVHConstructionAlgorithm::kSAH,
+               &thread_pool, rays);
+  RunBenchmark("LBVH serial", argv[1], BVHConstructionAlgorithm::kLBVH,
+               nullptr, rays);
+  RunBenchmark("LBVH parallel", argv[1], BVHConstructionAlgorithm::kLBVH,
+               &thread_pool, rays);
+  RunBenchmark("Treelet LBVH serial", argv[1],
+               BVHConstructionAlgorithm::kTreeletLBVH, nullptr, rays);
+  RunBenchmark("Treelet LBVH parallel", argv[1],
+               BVHConstructionAlgorithm::kTreeletLBVH, &thread_pool, rays);
+
+  return 0;
+}
\ No newline at end of file
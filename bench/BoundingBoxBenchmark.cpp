@@ -0,0 +1,168 @@
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <random>
+
+#include "MeshObject.hpp"
+
+// Slab test used by the BVH before rays carried their reciprocal direction,
+// kept here as the baseline of the comparison
+static bool IntersectNodeDivision(const LinearBVHNode& node, const Ray& ray,
+                                  float t_closest) {
+  float t_min = (node.min_point_.x - ray.origin_.x) / ray.direction_.x;
+  float t_max = (node.max_point_.x - ray.origin_.x) / ray.direction_.x;
+
+  if (t_min > t_max) {
+    std::swap(t_min, t_max);
+  }
+
+  float t_y_min = (node.min_point_.y - ray.origin_.y) / ray.direction_.y;
+  float t_y_max = (node.max_point_.y - ray.origin_.y) / ray.direction_.y;
+
+  if (t_y_min > t_y_max) {
+    std::swap(t_y_min, t_y_max);
+  }
+
+  if ((t_min > t_y_max) || (t_y_min > t_max)) {
+    return false;
+  }
+
+  if (t_y_min > t_min) {
+    t_min = t_y_min;
+  }
+
+  if (t_y_max < t_max) {
+    t_max = t_y_max;
+  }
+
+  float t_z_min = (node.min_point_.z - ray.origin_.z) / ray.direction_.z;
+  float t_z_max = (node.max_point_.z - ray.origin_.z) / ray.direction_.z;
+
+  if (t_z_min > t_z_max) {
+    std::swap(t_z_min, t_z_max);
+  }
+
+  if ((t_min > t_z_max) || (t_z_min > t_max)) {
+    return false;
+  }
+
+  if (t_z_min > t_min) {
+    t_min = t_z_min;
+  }
+
+  if (t_z_max < t_max) {
+    t_max = t_z_max;
+  }
+
+  return t_max >= 0 && t_min <= t_closest;
+}
+
+struct NodeTest {
+  uint32_t ray_index_;
+  uint32_t node_offset_;
+};
+
+// Records the node tests a traversal without primitive intersections performs,
+// so that the timed loops see the same mix of hits and misses as rendering
+static std::vector<NodeTest> RecordNodeTests(
+    const std::vector<Ray>& rays, const std::vector<LinearBVHNode>& nodes) {
+  std::vector<NodeTest> node_tests;
+  for (uint32_t ray_index = 0; ray_index < rays.size(); ray_index++) {
+    const Ray& ray = rays[ray_index];
+    uint32_t nodes_to_visit[kMaxBVHDepth];
+    int to_visit_count = 0;
+    uint32_t current_node_offset = 0;
+    while (true) {
+      const LinearBVHNode& node = nodes[current_node_offset];
+      node_tests.push_back({ray_index, current_node_offset});
+      if (IntersectNodeDivision(node, ray,
+                                std::numeric_limits<float>::max()) &&
+          node.primitive_count_ == 0) {
+        nodes_to_visit[to_visit_count++] = node.second_child_offset_;
+        current_node_offset = current_node_offset + 1;
+      } else {
+        if (to_visit_count == 0) {
+          break;
+        }
+        current_node_offset = nodes_to_visit[--to_visit_count];
+      }
+    }
+  }
+  return node_tests;
+}
+
+template <typename NodeTestFunction>
+static void Measure(const std::string& name, const std::vector<Ray>& rays,
+                    const std::vector<LinearBVHNode>& nodes,
+                    const std::vector<NodeTest>& node_tests,
+                    NodeTestFunction node_test_function) {
+  const int repetitions = 10;
+  auto start = std::chrono::steady_clock::now();
+  uint64_t hit_count = 0;
+  for (int i = 0; i < repetitions; i++) {
+    for (const auto& node_test : node_tests) {
+      hit_count += node_test_function(nodes[node_test.node_offset_],
+                                      rays[node_test.ray_index_],
+                                      std::numeric_limits<float>::max());
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+
+  std::cout << name << ": "
+            << double(node_tests.size()) * repetitions / seconds / 1e6
+            << " M node tests/s, " << hit_count / repetitions << " hits"
+            << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <ply_file> <ray_count [OPTIONAL]>"
+              << std::endl;
+    return 1;
+  }
+  int ray_count = argc > 2 ? std::stoi(argv[2]) : 10000;
+
+  MeshObject mesh(nullptr, argv[1], Vec3f{0, 0, 0}, IDENTITY_MATRIX,
+                  RawScalingFlip{false, false, false});
+  mesh.Preprocess(false, true);
+  const std::vector<LinearBVHNode>& nodes = mesh.bvh_->nodes_;
+
+  // Rays start on a sphere around the mesh and aim at points inside its
+  // bounds, every tenth one is axis aligned to exercise the infinite
+  // reciprocal directions. Every other one of those has -0 components, whose
+  // reciprocals are -inf.
+  Vec3f center = (mesh.min_point_ + mesh.max_point_) * 0.5f;
+  Vec3f extent = mesh.max_point_ - mesh.min_point_;
+  float radius = norm(extent);
+  std::mt19937 generator(795);
+  std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+  std::vector<Ray> rays;
+  for (int i = 0; i < ray_count; i++) {
+    Vec3f origin = center + radius * normalize(Vec3f{distribution(generator),
+                                                     distribution(generator),
+                                                     distribution(generator)});
+    Vec3f target = center + 0.5f * hadamard(extent,
+                                            Vec3f{distribution(generator),
+                                                  distribution(generator),
+                                                  distribution(generator)});
+    Vec3f direction = normalize(target - origin);
+    if (i % 10 == 0) {
+      direction = i % 20 == 0 ? Vec3f{0, 0, 0} : Vec3f{-0.0f, 0, -0.0f};
+      direction.y = target.y < origin.y ? -1.0f : 1.0f;
+      origin = Vec3f{target.x, origin.y, target.z};
+    }
+    rays.push_back(Ray({0, 0}, origin, direction));
+  }
+
+  std::vector<NodeTest> node_tests = RecordNodeTests(rays, nodes);
+
+  std::cout << nodes.size() << " nodes, " << rays.size() << " rays, "
+            << node_tests.size() << " node tests" << std::endl;
+  Measure("Division slab test", rays, nodes, node_tests,
+          IntersectNodeDivision);
+  Measure("Reciprocal slab test", rays, nodes, node_tests,
+          BoundingVolumeHierarchy::IntersectNode);
+
+  return 0;
+}
@@ -0,0 +1,88 @@
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <random>
+
+#include "MeshObject.hpp"
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0]
+              << " <ply_file> <resolution [OPTIONAL]> <samples [OPTIONAL]>"
+              << std::endl;
+    return 1;
+  }
+  int resolution = argc > 2 ? std::stoi(argv[2]) : 256;
+  int sample_count = argc > 3 ? std::stoi(argv[3]) : 16;
+
+  std::shared_ptr<MeshObject> mesh = std::make_shared<MeshObject>(
+      nullptr, argv[1], Vec3f{0, 0, 0}, IDENTITY_MATRIX,
+      RawScalingFlip{false, false, false});
+  mesh->Preprocess(false, true);
+
+  // Camera rays of a pinhole looking at the mesh, the samples of a pixel are
+  // consecutive like the ones the cameras generate
+  Vec3f center = (mesh->min_point_ + mesh->max_point_) * 0.5f;
+  float radius = norm(mesh->max_point_ - mesh->min_point_);
+  Vec3f position = center + Vec3f{0.3f, 0.4f, 1.0f} * radius;
+  Vec3f w = normalize(center - position);
+  Vec3f u = normalize(cross(w, Vec3f{0, 1, 0}));
+  Vec3f v = cross(u, w);
+  std::mt19937 generator(795);
+  std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+  std::vector<Ray> rays;
+  for (int y = 0; y < resolution; y++) {
+    for (int x = 0; x < resolution; x++) {
+      for (int i = 0; i < sample_count; i++) {
+        float su = (x + distribution(generator)) / resolution - 0.5f;
+        float sv = (y + distribution(generator)) / resolution - 0.5f;
+        Vec3f direction = normalize(w + u * su * 0.8f + v * sv * 0.8f);
+        rays.push_back(Ray({x, y}, position, direction));
+      }
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  uint64_t single_hit_count = 0;
+  for (const auto& ray : rays) {
+    HitRecord hit;
+    hit.t_ = std::numeric_limits<float>::max();
+    single_hit_count += mesh->Intersect(ray, hit);
+  }
+  auto end = std::chrono::steady_clock::now();
+  double single_seconds = std::chrono::duration<double>(end - start).count();
+
+  start = std::chrono::steady_clock::now();
+  uint64_t packet_hit_count = 0;
+  HitRecord hits[kRayPacketWidth];
+  for (size_t first = 0; first < rays.size(); first += kRayPacketWidth) {
+    RayPacket packet;
+    packet.Load(&rays[first],
+                std::min<size_t>(kRayPacketWidth, rays.size() - first));
+    for (int lane = 0; lane < packet.ray_count_; lane++) {
+      hits[lane].object_ = nullptr;
+    }
+    if (packet.coherent_) {
+      mesh->IntersectPacket(packet, packet.ActiveMask(), hits);
+    } else {
+      for (int lane = 0; lane < packet.ray_count_; lane++) {
+        hits[lane].t_ = packet.t_closest_[lane];
+        mesh->Intersect(rays[first + lane], hits[lane]);
+      }
+    }
+    for (int lane = 0; lane < packet.ray_count_; lane++) {
+      packet_hit_count += hits[lane].object_ != nullptr;
+    }
+  }
+  end = std::chrono::steady_clock::now();
+  double packet_seconds = std::chrono::duration<double>(end - start).count();
+
+  std::cout << rays.size() << " rays, packets of " << kRayPacketWidth
+            << std::endl;
+  std::cout << "Single rays: " << rays.size() / single_seconds / 1e6
+            << " M rays/s, " << single_hit_count << " hits" << std::endl;
+  std::cout << "Packets: " << rays.size() / packet_seconds / 1e6
+            << " M rays/s, " << packet_hit_count << " hits" << std::endl;
+
+  return 0;
+}
\ No newline at end of file
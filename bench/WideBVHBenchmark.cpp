@@ -0,0 +1,87 @@
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <random>
+
+#include "MeshObject.hpp"
+
+static std::shared_ptr<MeshObject> LoadMesh(const char* ply_filename,
+                                            BVHLayout layout) {
+  std::shared_ptr<MeshObject> mesh = std::make_shared<MeshObject>(
+      nullptr, ply_filename, Vec3f{0, 0, 0}, IDENTITY_MATRIX,
+      RawScalingFlip{false, false, false}, BVHConstructionAlgorithm::kBest,
+      layout);
+  mesh->Preprocess(false, true);
+  return mesh;
+}
+
+static void RunBenchmark(const std::string& name,
+                         const std::shared_ptr<MeshObject>& mesh,
+                         std::vector<Ray>& rays) {
+  auto start = std::chrono::steady_clock::now();
+  uint64_t hit_count = 0;
+  for (const auto& ray : rays) {
+    HitRecord hit;
+    hit.t_ = std::numeric_limits<float>::max();
+    hit_count += mesh->Intersect(ray, hit);
+  }
+  auto end = std::chrono::steady_clock::now();
+  double intersect_seconds = std::chrono::duration<double>(end - start).count();
+
+  start = std::chrono::steady_clock::now();
+  uint64_t occluded_count = 0;
+  for (auto& ray : rays) {
+    occluded_count += mesh->Occluded(ray, std::numeric_limits<float>::max());
+  }
+  end = std::chrono::steady_clock::now();
+  double occluded_seconds = std::chrono::duration<double>(end - start).count();
+
+  std::cout << name << ": closest hit "
+            << rays.size() / intersect_seconds / 1e6 << " M rays/s, "
+            << hit_count << " hits, any hit "
+            << rays.size() / occluded_seconds / 1e6 << " M rays/s, "
+            << occluded_count << " hits" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <ply_file> <ray_count [OPTIONAL]>"
+              << std::endl;
+    return 1;
+  }
+  int ray_count = argc > 2 ? std::stoi(argv[2]) : 1000000;
+
+  std::shared_ptr<MeshObject> binary_mesh =
+      LoadMesh(argv[1], BVHLayout::kBinary);
+  std::shared_ptr<MeshObject> bvh4_mesh = LoadMesh(argv[1], BVHLayout::kBVH4);
+  std::shared_ptr<MeshObject> bvh8_mesh = LoadMesh(argv[1], BVHLayout::kBVH8);
+
+  // Incoherent rays from a sphere around the mesh towards points inside its
+  // bounds, like the secondary rays that dominate the single ray traversal
+  Vec3f center = (binary_mesh->min_point_ + binary_mesh->max_point_) * 0.5f;
+  Vec3f extent = binary_mesh->max_point_ - binary_mesh->min_point_;
+  float radius = norm(extent);
+  std::mt19937 generator(795);
+  std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+  std::vector<Ray> rays;
+  rays.reserve(ray_count);
+  for (int i = 0; i < ray_count; i++) {
+    Vec3f origin = normalize(Vec3f{distribution(generator),
+                                   distribution(generator),
+                                   distribution(generator)}) *
+                       radius +
+                   center;
+    Vec3f target = center + Vec3f{distribution(generator) * extent.x,
+                                  distribution(generator) * extent.y,
+                                  distribution(generator) * extent.z} *
+                                0.5f;
+    rays.push_back(Ray({0, 0}, origin, normalize(target - origin)));
+  }
+
+  std::cout << ray_count << " rays, SIMD width " << kSimdWidth << std::endl;
+  RunBenchmark("Binary", binary_mesh, rays);
+  RunBenchmark("BVH4", bvh4_mesh, rays);
+  RunBenchmark("BVH8", bvh8_mesh, rays);
+
+  return 0;
+}
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include "Configuration.hpp"
 #include "Helper.hpp"
 #include "Ray.hpp"
+#include "Sampler.hpp"
 
 using namespace parser;
 
@@ -27,7 +28,9 @@ class BaseCamera {
     delete[] image_data_;
   };
 
-  virtual std::vector<Ray> GenerateRay(const Vec2i& pixel_coordinate) const;
+  // Fills rays with the samples of a pixel and returns their count, rays has
+  // to hold mem_num_samples_ elements
+  virtual int GenerateRays(const Vec2i& pixel_coordinate, Ray* rays) const;
 
   virtual void UpdatePixelValue(const Vec2i& pixel_coordinate,
                                 const Vec3f& pixel_value);
@@ -65,9 +68,12 @@ class BaseCamera {
 
   const ApertureType aperture_type_;
 
-  std::function<std::vector<Vec2f>(int)> pixel_sampling_algorithm_;
-  std::function<std::vector<float>(int)> time_sampling_algorithm_;
-  std::function<std::vector<Vec2f>(int)> aperture_sampling_algorithm_;
+  bool IsInsideAperture(const Vec2f& aperture_sample) const;
+
+  Sampler pixel_sampler_;
+  Sampler time_sampler_;
+  Sampler aperture_sampler_;
+  int aperture_edge_count_;  // 0 for circular and square apertures
 
   Vec5f* image_sampled_data_;
   Vec3f* image_data_;
@@ -1,21 +1,69 @@
 #pragma once
 
+#include <cstdint>
+
 #include "../extern/parser.h"
 
 using namespace parser;
 
+enum class MaterialType : uint8_t {
+  kDefault = 0,
+  kMirror = 1,
+  kConductor = 2,
+  kDielectric = 3,
+  kMax = 3
+};
+
+// Everything shading needs to know about a material in one flat record. The
+// scene keeps the records of all materials in a vector indexed by material
+// id, so the ray tracing algorithms switch on type_ instead of casting the
+// material classes.
+struct MaterialRecord {
+  MaterialType type_;
+  Vec3f ambient_;
+  Vec3f diffuse_;
+  Vec3f specular_;
+  float phong_exponent_;
+  float roughness_;
+  // Mirror, conductor and dielectric
+  Vec3f mirror_;
+  // Conductor and dielectric
+  float refraction_index_;
+  // Conductor
+  float absorption_index_;
+  // Dielectric
+  Vec3f absorption_coefficient_;
+};
+
 class BaseMaterial {
  public:
-  BaseMaterial(const Vec3f& ambient, const Vec3f& diffuse,
+  BaseMaterial(int id, const Vec3f& ambient, const Vec3f& diffuse,
                const Vec3f& specular, const float phong_exponent,
-               const float roughness)
-      : ambient_(ambient),
+               const float roughness,
+               MaterialType type = MaterialType::kDefault)
+      : id_(id),
+        type_(type),
+        ambient_(ambient),
         diffuse_(diffuse),
         specular_(specular),
         phong_exponent_(phong_exponent),
         roughness_(roughness) {}
   virtual ~BaseMaterial() {}
 
+  virtual MaterialRecord Record() const {
+    MaterialRecord record = {};
+    record.type_ = type_;
+    record.ambient_ = ambient_;
+    record.diffuse_ = diffuse_;
+    record.specular_ = specular_;
+    record.phong_exponent_ = phong_exponent_;
+    record.roughness_ = roughness_;
+    return record;
+  }
+
+  // Index of the material in the scene, and of its record
+  const int id_;
+  const MaterialType type_;
   const Vec3f ambient_;
   const Vec3f diffuse_;
   const Vec3f specular_;
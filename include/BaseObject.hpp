@@ -5,39 +5,60 @@
 #include "../extern/parser.h"
 #include "BaseMaterial.hpp"
 #include "BoundingVolumeHierarchy.hpp"
+#include "Helper.hpp"
 #include "Ray.hpp"
 
 using namespace parser;
 
-class BaseObject : public BoundingVolumeHierarchyElement,
-                   public std::enable_shared_from_this<BaseObject> {
+class BaseObject : public BoundingVolumeHierarchyElement {
  public:
   BaseObject(std::shared_ptr<BaseMaterial> material, const Vec3f motion_blur,
              const Mat4x4f& transform_matrix, RawScalingFlip scaling_flip)
       : material_(material),
+        material_id_(material ? material->id_ : -1),
         motion_blur_(motion_blur),
         transform_matrix_(transform_matrix),
         scaling_flip_(scaling_flip) {
     inverse_transform_matrix_ = ~transform_matrix_;
     inverse_transpose_transform_matrix_ = !inverse_transform_matrix_;
-  }
-
-  virtual void InitializeSelf(const Vec3f& min_point,
-                              const Vec3f& max_point) override final {
-    min_point_ = min_point;
-    max_point_ = max_point;
+    identity_transform_ = is_identity(transform_matrix_) &&
+                          motion_blur_.x == 0 && motion_blur_.y == 0 &&
+                          motion_blur_.z == 0;
   }
 
   std::shared_ptr<BaseMaterial> material_;
+  // Index of the record of material_ in the material table of the scene
+  int material_id_;
 
   virtual ~BaseObject() = default;
+  // Objects with a thread_pool may spread their BVH build over it, they are
+  // preprocessed one at a time outside of the pool
   virtual void Preprocess(bool high_level_bvh_enabled,
                           bool low_level_bvh_enabled,
-                          bool transform_enabled = true) {};
+                          bool transform_enabled = true,
+                          ThreadPool* /*thread_pool*/ = nullptr) {};
+
+  // Moves the ray into object space without normalizing its direction, so
+  // distances along it keep their world space parametrization
+  Ray TransformRayToObjectSpace(const Ray& ray) const {
+    if (identity_transform_) {
+      return ray;
+    }
+    Vec3f transformed_ray_origin =
+        inverse_transform_matrix_ * (ray.origin_ - motion_blur_ * ray.time_);
+    Vec3f transformed_ray_destination =
+        inverse_transform_matrix_ *
+        (ray.origin_ - motion_blur_ * ray.time_ + ray.direction_);
+    return Ray{ray.pixel_, transformed_ray_origin,
+               transformed_ray_destination - transformed_ray_origin, ray.diff_,
+               ray.time_};
+  }
 
   Vec3f motion_blur_;
   Mat4x4f transform_matrix_;
   Mat4x4f inverse_transform_matrix_;
   Mat4x4f inverse_transpose_transform_matrix_;
   RawScalingFlip scaling_flip_;
+  // Neither transformed nor motion blurred, object space is world space
+  bool identity_transform_;
 };
\ No newline at end of file
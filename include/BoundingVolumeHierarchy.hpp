@@ -1,47 +1,606 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
 #include <memory>
 
 #include "../extern/parser.h"
+#include "Configuration.hpp"
 #include "Ray.hpp"
+#include "RayPacket.hpp"
 
 using namespace parser;
 
+class ThreadPool;
+
+// Node of the flattened BVH. Nodes are stored in depth-first order, so the
+// first child of an interior node always directly follows its parent and only
+// the offset of the second child has to be kept. Leaf nodes keep the range of
+// their primitives instead.
+struct alignas(32) LinearBVHNode {
+  Vec3f min_point_;
+  union {
+    uint32_t primitives_offset_;    // Leaf
+    uint32_t second_child_offset_;  // Interior
+  };
+  Vec3f max_point_;
+  uint16_t primitive_count_;  // 0 for interior nodes
+  uint8_t axis_;              // Split axis of interior nodes
+  uint8_t padding_;
+};
+
+static_assert(sizeof(LinearBVHNode) == 32,
+              "LinearBVHNode is expected to fit in 32 bytes");
+
+// Size of the traversal stack, builders keep the tree depth below it
+const int kMaxBVHDepth = 64;
+
+// Builds over at least this many primitives are spread over the thread pool
+// they are given, smaller ones are faster on the calling thread alone
+const int kParallelBuildMinPrimitives = 1 << 15;
+
+// Primitive order entry of the slots that only pad a leaf to a whole block
+const uint32_t kPaddingPrimitive = UINT32_MAX;
+
+// Equal parts of the shutter that get a BVH of their own over the moving
+// primitives. A power of two, so the segment of a ray time is found exactly.
+const int kMotionBVHTimeSegments = 8;
+
+// Node of the wide BVH collapsed from the binary one. The child bounds are
+// stored in SoA layout, so one ray is tested against kSimdWidth children at
+// once. A child is either another wide node or a leaf range of primitives,
+// unused slots have empty bounds and are never hit.
+template <int Width>
+struct alignas(32) WideBVHNode {
+  // Slots are padded to whole SIMD groups
+  static const int kSlotCount = Width > kSimdWidth ? Width : kSimdWidth;
+
+  float min_point_[3][kSlotCount];
+  float max_point_[3][kSlotCount];
+  uint32_t child_offsets_[kSlotCount];     // Wide node or first primitive
+  uint16_t primitive_counts_[kSlotCount];  // 0 for interior children
+};
+
+// Traversal stack entry of the wide BVH, the entry distance lets the nodes
+// behind the closest hit found meanwhile be skipped when popped
+struct WideBVHStackEntry {
+  uint32_t offset_;
+  uint32_t primitive_count_;
+  float t_entry_;
+};
+
 class BoundingVolumeHierarchyElement;
 
+// Closest hit of a ray. The queries only write it for a hit closer than t_,
+// so callers start with t_ at the far end of the range and every query of a
+// ray narrows down the same record. object_ identifies the scene object that
+// was hit without owning it, the scene keeps its objects alive while it
+// renders.
+struct HitRecord {
+  float t_;
+  // Triangle slot within a mesh, 0 for the other objects
+  uint32_t primitive_id_;
+  const BoundingVolumeHierarchyElement* object_;
+  // Barycentric weights of the second and third vertex of a triangle hit, 0
+  // for spheres
+  float u_;
+  float v_;
+  // World space geometric normal
+  Vec3f normal_;
+};
+
 class BoundingVolumeHierarchyElement {
  public:
   BoundingVolumeHierarchyElement() { id_ = id_counter_++; }
 
-  virtual void InitializeSelf(const Vec3f& min_point, const Vec3f& max_point) {
+  // Bounds at the start of the shutter and their translation over it, the
+  // element is within the bounds moved by time * motion at any ray time
+  virtual void InitializeSelf(const Vec3f& min_point, const Vec3f& max_point,
+                              const Vec3f& motion = {0, 0, 0}) {
+    min_point_ = min_point;
+    max_point_ = max_point;
+    motion_ = motion;
   };
-  void InitializeChildren(
-      std::shared_ptr<BoundingVolumeHierarchyElement> left,
-      std::shared_ptr<BoundingVolumeHierarchyElement> right) {
-    left_ = left;
-    right_ = right;
-  }
-  virtual std::shared_ptr<BoundingVolumeHierarchyElement> Intersect(
-      Ray& ray, float& t_hit, Vec3f& intersection_normal,
-      bool backface_culling = true, bool stop_at_any_hit = false) const;
+  // Returns true and fills hit if the ray hits the element closer than
+  // hit.t_, the ray is left as it is
+  virtual bool Intersect(const Ray& ray, HitRecord& hit,
+                         bool backface_culling = true,
+                         bool stop_at_any_hit = false) const = 0;
+  // Returns true as soon as any hit in [epsilon, t_max) is found, t_max is in
+  // units of the ray direction
+  virtual bool Occluded(const Ray& ray, float t_max) const = 0;
+  // Closest hit query for the lanes of lane_mask. Lanes that hit closer than
+  // their t_closest_ lower it and get their hit written, the default tests
+  // the rays one by one with Intersect. t_closest_ is the distance of a lane
+  // meanwhile, it is copied into the t_ of its hit once the packet is done.
+  virtual void IntersectPacket(RayPacket& packet, uint32_t lane_mask,
+                               HitRecord* hits,
+                               bool backface_culling = true) const;
 
   virtual ~BoundingVolumeHierarchyElement() = default;
 
-  static std::shared_ptr<BoundingVolumeHierarchyElement> Construct(
-      std::vector<std::shared_ptr<BoundingVolumeHierarchyElement>>& leafs,
-      int start, int end, int axis);
-
-  static void PrintBVH(
-      const std::shared_ptr<BoundingVolumeHierarchyElement>& root);
-
-  std::shared_ptr<BoundingVolumeHierarchyElement> left_ = nullptr;
-  std::shared_ptr<BoundingVolumeHierarchyElement> right_ = nullptr;
-
   Vec3f min_point_;
   Vec3f max_point_;
+  Vec3f motion_;
 
   static bool trace_;
   static std::vector<Vec2i> trace_pixels_;
   uint64_t id_;
-  static uint64_t id_counter_;
-};
\ No newline at end of file
+  // Elements are created by concurrent preprocessing tasks
+  static std::atomic<uint64_t> id_counter_;
+};
+
+class BoundingVolumeHierarchy : public BoundingVolumeHierarchyElement {
+ public:
+  // Builds over elements. The static ones are bounded by the nodes below, the
+  // moving ones by one BVH per time segment that only sweeps their bounds
+  // over that part of the shutter, and the queries visit both. Builds with a
+  // thread_pool split the top levels in parallel and build the subtrees below
+  // them as tasks of the pool, so they must not run on the pool themselves.
+  BoundingVolumeHierarchy(
+      const std::vector<std::shared_ptr<BoundingVolumeHierarchyElement>>&
+          primitives,
+      const BVHConstructionAlgorithm construction_algorithm =
+          BVHConstructionAlgorithm::kBest,
+      const BVHLayout layout = BVHLayout::kBest,
+      ThreadPool* thread_pool = nullptr);
+  // Builds over bare bounds for primitives that are not BVH elements, such as
+  // the triangles of an indexed mesh. primitive_order receives the primitive
+  // index of every leaf slot, so the owner can store its primitives in leaf
+  // order and index them with the slots passed to the traversals below.
+  // Owners that test leaf_block_width primitives at once get leaves of up to
+  // that many primitives, each leaf costing a single test. Every leaf then
+  // starts at a multiple of leaf_block_width and the slots it leaves empty
+  // are kPaddingPrimitive in primitive_order, so the block of a leaf follows
+  // from its first slot.
+  BoundingVolumeHierarchy(
+      const std::vector<Vec3f>& primitive_min_points,
+      const std::vector<Vec3f>& primitive_max_points,
+      std::vector<uint32_t>& primitive_order,
+      const BVHConstructionAlgorithm construction_algorithm =
+          BVHConstructionAlgorithm::kBest,
+      const BVHLayout layout = BVHLayout::kBest, int leaf_block_width = 1,
+      ThreadPool* thread_pool = nullptr);
+  // Takes over the binary nodes of a BVH over bare bounds built earlier, such
+  // as the one of a mesh cache, and collapses them into layout
+  BoundingVolumeHierarchy(std::vector<LinearBVHNode>&& nodes,
+                          const BVHLayout layout = BVHLayout::kBest);
+
+  bool Intersect(const Ray& ray, HitRecord& hit, bool backface_culling = true,
+                 bool stop_at_any_hit = false) const override;
+  bool Occluded(const Ray& ray, float t_max) const override;
+  void IntersectPacket(RayPacket& packet, uint32_t lane_mask, HitRecord* hits,
+                       bool backface_culling = true) const override;
+
+  virtual ~BoundingVolumeHierarchy() = default;
+
+  void PrintBVH() const;
+
+  // Closest hit traversal, intersect_primitive(slot, t_closest) tests the
+  // primitive of a leaf slot and returns true after lowering t_closest. The
+  // traversal can start at an interior node to visit only its subtree, which
+  // always walks the binary nodes. Whole tree queries use the wide nodes when
+  // they were built.
+  template <typename IntersectPrimitive>
+  bool IntersectPrimitives(const Ray& ray, float& t_closest,
+                           IntersectPrimitive intersect_primitive,
+                           uint32_t root_node_offset = 0) const;
+  // IntersectPrimitives handing over whole leaves, intersect_leaf(first_slot,
+  // slot_count, t_closest) tests the primitives of a leaf together
+  template <typename IntersectLeaf>
+  bool IntersectLeaves(const Ray& ray, float& t_closest,
+                       IntersectLeaf intersect_leaf,
+                       uint32_t root_node_offset = 0) const;
+  // Closest hit traversal of a coherent packet with one shared stack.
+  // intersect_primitive_packet(slot, lane_mask) tests the primitive of a leaf
+  // slot against the lanes that reached the leaf. A subtree that only a single
+  // lane enters is finished by the single ray traversal, which calls
+  // intersect_primitive(lane, slot, t_closest) like IntersectPrimitives.
+  template <typename IntersectPrimitivePacket, typename IntersectPrimitive>
+  void IntersectPrimitivesPacket(
+      RayPacket& packet, uint32_t lane_mask,
+      IntersectPrimitivePacket intersect_primitive_packet,
+      IntersectPrimitive intersect_primitive) const;
+  // Any hit traversal, occluded_primitive(slot) returns true on any hit
+  template <typename OccludedPrimitive>
+  bool OccludedPrimitives(const Ray& ray, float t_max,
+                          OccludedPrimitive occluded_primitive) const;
+  // OccludedPrimitives handing over whole leaves like IntersectLeaves,
+  // occluded_leaf(first_slot, slot_count) returns true on any hit
+  template <typename OccludedLeaf>
+  bool OccludedLeaves(const Ray& ray, float t_max,
+                      OccludedLeaf occluded_leaf) const;
+
+  template <typename Node, typename IntersectLeaf>
+  static bool IntersectLeavesWide(const std::vector<Node>& nodes,
+                                  const Ray& ray, float& t_closest,
+                                  IntersectLeaf intersect_leaf);
+  template <typename Node, typename OccludedLeaf>
+  static bool OccludedLeavesWide(const std::vector<Node>& nodes,
+                                 const Ray& ray, float t_max,
+                                 OccludedLeaf occluded_leaf);
+
+  static bool IntersectNode(const LinearBVHNode& node, const Ray& ray,
+                            float t_closest);
+  // IntersectNode for all children of a wide node at once, returns the mask
+  // of the hit children and writes their entry distances to t_entries
+  template <int Width>
+  static uint32_t IntersectWideNode(const WideBVHNode<Width>& node,
+                                    const Ray& ray, float t_closest,
+                                    float* t_entries);
+  // IntersectNode for all lanes at once, returns the mask of the lanes that
+  // hit the node
+  static uint32_t IntersectNodePacket(const LinearBVHNode& node,
+                                      const RayPacket& packet);
+
+  std::vector<LinearBVHNode> nodes_;
+  // Wide nodes collapsed from nodes_, at most one of them is built. nodes_
+  // stays for the packet traversal and subtree queries.
+  std::vector<WideBVHNode<4>> bvh4_nodes_;
+  std::vector<WideBVHNode<8>> bvh8_nodes_;
+  // Primitives reordered so that every leaf references a contiguous range,
+  // empty when the BVH is built over bare bounds
+  std::vector<std::shared_ptr<BoundingVolumeHierarchyElement>> primitives_;
+  // kMotionBVHTimeSegments BVHs over the moving primitives in shutter order,
+  // empty when nothing moves
+  std::vector<std::shared_ptr<BoundingVolumeHierarchy>> time_segments_;
+
+ private:
+  BoundingVolumeHierarchy() = default;
+  // Builds the nodes over the primitive bounds swept over the ray times in
+  // [time_begin, time_end]
+  void BuildOverTime(
+      const std::vector<std::shared_ptr<BoundingVolumeHierarchyElement>>&
+          primitives,
+      const BVHConstructionAlgorithm construction_algorithm,
+      const BVHLayout layout, float time_begin, float time_end,
+      ThreadPool* thread_pool);
+  static int TimeSegmentIndex(float time) {
+    int segment = int(time * kMotionBVHTimeSegments);
+    return std::max(0, std::min(segment, kMotionBVHTimeSegments - 1));
+  }
+  const BoundingVolumeHierarchy& TimeSegment(float time) const {
+    return *time_segments_[TimeSegmentIndex(time)];
+  }
+};
+
+inline uint32_t BoundingVolumeHierarchy::IntersectNodePacket(
+    const LinearBVHNode& node, const RayPacket& packet) {
+  SimdFloat t_entry(0.0f);
+  SimdFloat t_exit = SimdFloat::Load(packet.t_closest_);
+
+  for (int axis = 0; axis < 3; axis++) {
+    SimdFloat near_plane(packet.direction_negative_[axis]
+                             ? component(node.max_point_, axis)
+                             : component(node.min_point_, axis));
+    SimdFloat far_plane(packet.direction_negative_[axis]
+                            ? component(node.min_point_, axis)
+                            : component(node.max_point_, axis));
+    SimdFloat origin = SimdFloat::Load(packet.origin_[axis]);
+    SimdFloat inverse_direction =
+        SimdFloat::Load(packet.inverse_direction_[axis]);
+    t_entry = simd_max((near_plane - origin) * inverse_direction, t_entry);
+    t_exit = simd_min((far_plane - origin) * inverse_direction, t_exit);
+  }
+
+  return simd_mask_bits(t_entry <= t_exit);
+}
+
+template <int Width>
+inline uint32_t BoundingVolumeHierarchy::IntersectWideNode(
+    const WideBVHNode<Width>& node, const Ray& ray, float t_closest,
+    float* t_entries) {
+  const float* near_planes[3];
+  const float* far_planes[3];
+  SimdFloat origin[3];
+  SimdFloat inverse_direction[3];
+  for (int axis = 0; axis < 3; axis++) {
+    near_planes[axis] = ray.direction_negative_[axis] ? node.max_point_[axis]
+                                                      : node.min_point_[axis];
+    far_planes[axis] = ray.direction_negative_[axis] ? node.min_point_[axis]
+                                                     : node.max_point_[axis];
+    origin[axis] = SimdFloat(component(ray.origin_, axis));
+    inverse_direction[axis] =
+        SimdFloat(component(ray.inverse_direction_, axis));
+  }
+
+  uint32_t hit_mask = 0;
+  for (int group = 0; group < WideBVHNode<Width>::kSlotCount;
+       group += kSimdWidth) {
+    SimdFloat t_entry(0.0f);
+    SimdFloat t_exit(t_closest);
+    for (int axis = 0; axis < 3; axis++) {
+      SimdFloat near_plane = SimdFloat::Load(near_planes[axis] + group);
+      SimdFloat far_plane = SimdFloat::Load(far_planes[axis] + group);
+      t_entry = simd_max((near_plane - origin[axis]) * inverse_direction[axis],
+                         t_entry);
+      t_exit = simd_min((far_plane - origin[axis]) * inverse_direction[axis],
+                        t_exit);
+    }
+    t_entry.Store(t_entries + group);
+    hit_mask |= simd_mask_bits(t_entry <= t_exit) << group;
+  }
+  return hit_mask;
+}
+
+template <typename IntersectPrimitive>
+bool BoundingVolumeHierarchy::IntersectPrimitives(
+    const Ray& ray, float& t_closest, IntersectPrimitive intersect_primitive,
+    uint32_t root_node_offset) const {
+  return IntersectLeaves(
+      ray, t_closest,
+      [&](uint32_t first_slot, uint32_t slot_count, float& leaf_t_closest) {
+        bool hit = false;
+        for (uint32_t i = 0; i < slot_count; i++) {
+          if (intersect_primitive(first_slot + i, leaf_t_closest)) {
+            hit = true;
+          }
+        }
+        return hit;
+      },
+      root_node_offset);
+}
+
+template <typename IntersectLeaf>
+bool BoundingVolumeHierarchy::IntersectLeaves(
+    const Ray& ray, float& t_closest, IntersectLeaf intersect_leaf,
+    uint32_t root_node_offset) const {
+  if (nodes_.empty()) {
+    return false;
+  }
+
+  bool trace = trace_ && std::find(trace_pixels_.begin(), trace_pixels_.end(),
+                                   ray.pixel_) != trace_pixels_.end();
+
+  // Traced rays stay on the binary nodes, whose visits are the ones printed
+  if (root_node_offset == 0 && !trace) {
+    if (!bvh8_nodes_.empty()) {
+      return IntersectLeavesWide(bvh8_nodes_, ray, t_closest, intersect_leaf);
+    }
+    if (!bvh4_nodes_.empty()) {
+      return IntersectLeavesWide(bvh4_nodes_, ray, t_closest, intersect_leaf);
+    }
+  }
+
+  bool hit = false;
+
+  uint32_t nodes_to_visit[kMaxBVHDepth];
+  int to_visit_count = 0;
+  uint32_t current_node_offset = root_node_offset;
+
+  while (true) {
+    const LinearBVHNode& node = nodes_[current_node_offset];
+    if (trace) {
+      std::cout << "Checking node id: " << current_node_offset << std::endl;
+      std::cout << "Min point: " << node.min_point_ << std::endl;
+      std::cout << "Max point: " << node.max_point_ << std::endl;
+      std::cout << "Ray pixel: " << ray.pixel_ << std::endl;
+      std::cout << "Ray origin: " << ray.origin_ << std::endl;
+      std::cout << "Ray direction: " << ray.direction_ << std::endl;
+    }
+
+    if (IntersectNode(node, ray, t_closest)) {
+      if (trace) {
+        std::cout << "Intersects with node id: " << current_node_offset
+                  << std::endl;
+      }
+
+      if (node.primitive_count_ > 0) {
+        if (intersect_leaf(node.primitives_offset_, node.primitive_count_,
+                           t_closest)) {
+          hit = true;
+        }
+        if (to_visit_count == 0) {
+          break;
+        }
+        current_node_offset = nodes_to_visit[--to_visit_count];
+      } else {
+        // Visit the child on the near side of the split first so that the
+        // closest hit shrinks as early as possible, depth-first order keeps
+        // the first child right after its parent
+        if (ray.direction_negative_[node.axis_]) {
+          nodes_to_visit[to_visit_count++] = current_node_offset + 1;
+          current_node_offset = node.second_child_offset_;
+        } else {
+          nodes_to_visit[to_visit_count++] = node.second_child_offset_;
+          current_node_offset = current_node_offset + 1;
+        }
+      }
+    } else {
+      if (to_visit_count == 0) {
+        break;
+      }
+      current_node_offset = nodes_to_visit[--to_visit_count];
+    }
+  }
+
+  return hit;
+}
+
+template <typename IntersectPrimitivePacket, typename IntersectPrimitive>
+void BoundingVolumeHierarchy::IntersectPrimitivesPacket(
+    RayPacket& packet, uint32_t lane_mask,
+    IntersectPrimitivePacket intersect_primitive_packet,
+    IntersectPrimitive intersect_primitive) const {
+  if (nodes_.empty()) {
+    return;
+  }
+
+  uint32_t nodes_to_visit[kMaxBVHDepth];
+  int to_visit_count = 0;
+  uint32_t current_node_offset = 0;
+
+  while (true) {
+    const LinearBVHNode& node = nodes_[current_node_offset];
+    uint32_t hit_mask = IntersectNodePacket(node, packet) & lane_mask;
+
+    if (hit_mask && node.primitive_count_ > 0) {
+      for (uint32_t i = 0; i < node.primitive_count_; i++) {
+        intersect_primitive_packet(node.primitives_offset_ + i, hit_mask);
+      }
+    } else if (hit_mask && (hit_mask & (hit_mask - 1)) == 0) {
+      // The packet diverged, the only lane left is cheaper to trace alone
+      int lane = lowest_lane(hit_mask);
+      IntersectPrimitives(
+          *packet.rays_[lane], packet.t_closest_[lane],
+          [&](uint32_t slot, float& t_closest) {
+            return intersect_primitive(lane, slot, t_closest);
+          },
+          current_node_offset);
+    } else if (hit_mask) {
+      if (packet.direction_negative_[node.axis_]) {
+        nodes_to_visit[to_visit_count++] = current_node_offset + 1;
+        current_node_offset = node.second_child_offset_;
+      } else {
+        nodes_to_visit[to_visit_count++] = node.second_child_offset_;
+        current_node_offset = current_node_offset + 1;
+      }
+      continue;
+    }
+
+    if (to_visit_count == 0) {
+      break;
+    }
+    current_node_offset = nodes_to_visit[--to_visit_count];
+  }
+}
+
+template <typename OccludedPrimitive>
+bool BoundingVolumeHierarchy::OccludedPrimitives(
+    const Ray& ray, float t_max, OccludedPrimitive occluded_primitive) const {
+  return OccludedLeaves(ray, t_max,
+                        [&](uint32_t first_slot, uint32_t slot_count) {
+                          for (uint32_t i = 0; i < slot_count; i++) {
+                            if (occluded_primitive(first_slot + i)) {
+                              return true;
+                            }
+                          }
+                          return false;
+                        });
+}
+
+template <typename OccludedLeaf>
+bool BoundingVolumeHierarchy::OccludedLeaves(const Ray& ray, float t_max,
+                                             OccludedLeaf occluded_leaf) const {
+  if (nodes_.empty()) {
+    return false;
+  }
+  if (!bvh8_nodes_.empty()) {
+    return OccludedLeavesWide(bvh8_nodes_, ray, t_max, occluded_leaf);
+  }
+  if (!bvh4_nodes_.empty()) {
+    return OccludedLeavesWide(bvh4_nodes_, ray, t_max, occluded_leaf);
+  }
+
+  uint32_t nodes_to_visit[kMaxBVHDepth];
+  int to_visit_count = 0;
+  uint32_t current_node_offset = 0;
+
+  while (true) {
+    const LinearBVHNode& node = nodes_[current_node_offset];
+    if (IntersectNode(node, ray, t_max)) {
+      if (node.primitive_count_ > 0) {
+        if (occluded_leaf(node.primitives_offset_, node.primitive_count_)) {
+          return true;
+        }
+        if (to_visit_count == 0) {
+          break;
+        }
+        current_node_offset = nodes_to_visit[--to_visit_count];
+      } else {
+        nodes_to_visit[to_visit_count++] = node.second_child_offset_;
+        current_node_offset = current_node_offset + 1;
+      }
+    } else {
+      if (to_visit_count == 0) {
+        break;
+      }
+      current_node_offset = nodes_to_visit[--to_visit_count];
+    }
+  }
+
+  return false;
+}
+
+template <typename Node, typename IntersectLeaf>
+bool BoundingVolumeHierarchy::IntersectLeavesWide(
+    const std::vector<Node>& nodes, const Ray& ray, float& t_closest,
+    IntersectLeaf intersect_leaf) {
+  bool hit = false;
+
+  // Every visited node replaces its entry with at most one per slot, and the
+  // wide tree is never deeper than the binary one
+  WideBVHStackEntry entries_to_visit[kMaxBVHDepth * Node::kSlotCount];
+  int to_visit_count = 0;
+  entries_to_visit[to_visit_count++] = {0, 0, 0.0f};
+
+  while (to_visit_count > 0) {
+    const WideBVHStackEntry entry = entries_to_visit[--to_visit_count];
+    if (entry.t_entry_ > t_closest) {
+      continue;
+    }
+
+    if (entry.primitive_count_ > 0) {
+      if (intersect_leaf(entry.offset_, entry.primitive_count_, t_closest)) {
+        hit = true;
+      }
+      continue;
+    }
+
+    const Node& node = nodes[entry.offset_];
+    float t_entries[Node::kSlotCount];
+    uint32_t hit_mask = IntersectWideNode(node, ray, t_closest, t_entries);
+
+    // Keep the pushed children sorted from far to near, so the nearest one is
+    // popped first and the closest hit shrinks as early as possible
+    int first = to_visit_count;
+    for (; hit_mask; hit_mask &= hit_mask - 1) {
+      int slot = lowest_lane(hit_mask);
+      WideBVHStackEntry child = {node.child_offsets_[slot],
+                                 node.primitive_counts_[slot],
+                                 t_entries[slot]};
+      int position = to_visit_count++;
+      while (position > first &&
+             entries_to_visit[position - 1].t_entry_ < child.t_entry_) {
+        entries_to_visit[position] = entries_to_visit[position - 1];
+        position--;
+      }
+      entries_to_visit[position] = child;
+    }
+  }
+
+  return hit;
+}
+
+template <typename Node, typename OccludedLeaf>
+bool BoundingVolumeHierarchy::OccludedLeavesWide(
+    const std::vector<Node>& nodes, const Ray& ray, float t_max,
+    OccludedLeaf occluded_leaf) {
+  WideBVHStackEntry entries_to_visit[kMaxBVHDepth * Node::kSlotCount];
+  int to_visit_count = 0;
+  entries_to_visit[to_visit_count++] = {0, 0, 0.0f};
+
+  while (to_visit_count > 0) {
+    const WideBVHStackEntry entry = entries_to_visit[--to_visit_count];
+    if (entry.primitive_count_ > 0) {
+      if (occluded_leaf(entry.offset_, entry.primitive_count_)) {
+        return true;
+      }
+      continue;
+    }
+
+    const Node& node = nodes[entry.offset_];
+    float t_entries[Node::kSlotCount];
+    for (uint32_t hit_mask = IntersectWideNode(node, ray, t_max, t_entries);
+         hit_mask; hit_mask &= hit_mask - 1) {
+      int slot = lowest_lane(hit_mask);
+      entries_to_visit[to_visit_count++] = {node.child_offsets_[slot],
+                                            node.primitive_counts_[slot],
+                                            t_entries[slot]};
+    }
+  }
+
+  return false;
+}
\ No newline at end of file
@@ -6,15 +6,24 @@ using namespace parser;
 
 class ConductorMaterial : public BaseMaterial {
  public:
-  ConductorMaterial(const Vec3f& ambient, const Vec3f& diffuse,
+  ConductorMaterial(int id, const Vec3f& ambient, const Vec3f& diffuse,
                     const Vec3f& specular, float phong_exponent,
                     float roughness, const Vec3f& mirror,
                     float refraction_index, float absorption_index)
-      : BaseMaterial(ambient, diffuse, specular, phong_exponent, roughness),
+      : BaseMaterial(id, ambient, diffuse, specular, phong_exponent, roughness,
+                     MaterialType::kConductor),
         mirror_(mirror),
         refraction_index_(refraction_index),
         absorption_index_(absorption_index) {}
 
+  MaterialRecord Record() const override {
+    MaterialRecord record = BaseMaterial::Record();
+    record.mirror_ = mirror_;
+    record.refraction_index_ = refraction_index_;
+    record.absorption_index_ = absorption_index_;
+    return record;
+  }
+
   const Vec3f mirror_;
   const float refraction_index_;
   const float absorption_index_;
@@ -7,6 +7,7 @@
 enum class RayTracingAlgorithm {
   kDefault = 0,
   kRecursive = 1,
+  kWavefront = 2,
   kBest = 1,
   kMax = 2
 };
@@ -14,8 +15,17 @@ enum class RayTracingAlgorithm {
 enum class SchedulingAlgorithm {
   kNonThread = 0,
   kThreadQueue = 1,
+  kWorkStealing = 2,
   kBest = 1,
-  kMax = 1
+  kMax = 2
+};
+
+enum class TileOrdering {
+  kScanline = 0,
+  kMorton = 1,
+  kSpiral = 2,
+  kDefault = 1,
+  kMax = 2
 };
 
 enum class SamplingAlgorithm {
@@ -25,8 +35,10 @@ enum class SamplingAlgorithm {
   kMultiJittered = 3,
   kHalton = 4,
   kHammersley = 5,
+  kSobol = 6,
+  kOwenSobol = 7,
   kBest = 5,
-  kMax = 5
+  kMax = 7
 };
 
 enum class FilteringAlgorithm {
@@ -47,6 +59,19 @@ enum class ApertureType {
   kMax = 4
 };
 
+// LBVH sorts along a Morton curve for near instant builds of lower quality,
+// the treelet variant restructures it afterwards to recover most of it
+enum class BVHConstructionAlgorithm {
+  kMedian = 0,
+  kSAH = 1,
+  kLBVH = 2,
+  kTreeletLBVH = 3,
+  kBest = 1,
+  kMax = 3
+};
+
+enum class BVHLayout { kBinary = 0, kBVH4 = 1, kBVH8 = 2, kBest = 2, kMax = 2 };
+
 enum class ToneMappingAlgorithm { kClamp = 0, kBest = 0, kMax = 0 };
 
 enum class ExporterType { kPPM = 0, kSTB = 1, kBest = 1, kMax = 1 };
@@ -80,6 +105,10 @@ struct Configuration {
   struct Strategies {
     RayTracingAlgorithm ray_tracing_algorithm_ = RayTracingAlgorithm::kBest;
     SchedulingAlgorithm scheduling_algorithm_ = SchedulingAlgorithm::kBest;
+    int tile_size_ = 16;
+    TileOrdering tile_ordering_ = TileOrdering::kDefault;
+    int thread_count_ = 0;
+    bool thread_affinity_ = false;
     ToneMappingAlgorithm tone_mapping_algorithm_ = ToneMappingAlgorithm::kBest;
     ExporterType exporter_type_ = ExporterType::kBest;
   } strategies_;
@@ -87,6 +116,11 @@ struct Configuration {
   struct Acceleration {
     bool bvh_low_level_ = true;
     bool bvh_high_level_ = true;
+    bool packet_traversal_ = true;
+    BVHConstructionAlgorithm bvh_construction_algorithm_ =
+        BVHConstructionAlgorithm::kBest;
+    BVHLayout bvh_layout_ = BVHLayout::kBest;
+    std::string bvh_cache_directory_ = "";
   } acceleration_;
 
   struct Timer {
@@ -120,6 +154,10 @@ struct Configuration {
       sampling_.time_sampling_ = SamplingAlgorithm::kHalton;
     } else if (sampling_algorithm == "hammersley") {
       sampling_.time_sampling_ = SamplingAlgorithm::kHammersley;
+    } else if (sampling_algorithm == "sobol") {
+      sampling_.time_sampling_ = SamplingAlgorithm::kSobol;
+    } else if (sampling_algorithm == "owen_sobol") {
+      sampling_.time_sampling_ = SamplingAlgorithm::kOwenSobol;
     } else {
       sampling_.time_sampling_ = SamplingAlgorithm::kBest;
     }
@@ -138,6 +176,10 @@ struct Configuration {
       sampling_.pixel_sampling_ = SamplingAlgorithm::kHalton;
     } else if (sampling_algorithm == "hammersley") {
       sampling_.pixel_sampling_ = SamplingAlgorithm::kHammersley;
+    } else if (sampling_algorithm == "sobol") {
+      sampling_.pixel_sampling_ = SamplingAlgorithm::kSobol;
+    } else if (sampling_algorithm == "owen_sobol") {
+      sampling_.pixel_sampling_ = SamplingAlgorithm::kOwenSobol;
     } else {
       sampling_.pixel_sampling_ = SamplingAlgorithm::kBest;
     }
@@ -155,6 +197,10 @@ struct Configuration {
       sampling_.aperture_sampling_ = SamplingAlgorithm::kHalton;
     } else if (sampling_algorithm == "hammersley") {
       sampling_.aperture_sampling_ = SamplingAlgorithm::kHammersley;
+    } else if (sampling_algorithm == "sobol") {
+      sampling_.aperture_sampling_ = SamplingAlgorithm::kSobol;
+    } else if (sampling_algorithm == "owen_sobol") {
+      sampling_.aperture_sampling_ = SamplingAlgorithm::kOwenSobol;
     } else {
       sampling_.aperture_sampling_ = SamplingAlgorithm::kBest;
     }
@@ -172,6 +218,10 @@ struct Configuration {
       sampling_.area_light_sampling_ = SamplingAlgorithm::kHalton;
     } else if (sampling_algorithm == "hammersley") {
       sampling_.area_light_sampling_ = SamplingAlgorithm::kHammersley;
+    } else if (sampling_algorithm == "sobol") {
+      sampling_.area_light_sampling_ = SamplingAlgorithm::kSobol;
+    } else if (sampling_algorithm == "owen_sobol") {
+      sampling_.area_light_sampling_ = SamplingAlgorithm::kOwenSobol;
     } else {
       sampling_.area_light_sampling_ = SamplingAlgorithm::kBest;
     }
@@ -225,6 +275,8 @@ struct Configuration {
       strategies_.ray_tracing_algorithm_ = RayTracingAlgorithm::kDefault;
     } else if (ray_tracing_algorithm == "recursive") {
       strategies_.ray_tracing_algorithm_ = RayTracingAlgorithm::kRecursive;
+    } else if (ray_tracing_algorithm == "wavefront") {
+      strategies_.ray_tracing_algorithm_ = RayTracingAlgorithm::kWavefront;
     } else {
       strategies_.ray_tracing_algorithm_ = RayTracingAlgorithm::kBest;
     }
@@ -235,10 +287,31 @@ struct Configuration {
       strategies_.scheduling_algorithm_ = SchedulingAlgorithm::kNonThread;
     } else if (scheduling_algorithm == "thread_queue") {
       strategies_.scheduling_algorithm_ = SchedulingAlgorithm::kThreadQueue;
+    } else if (scheduling_algorithm == "work_stealing") {
+      strategies_.scheduling_algorithm_ = SchedulingAlgorithm::kWorkStealing;
     } else {
       strategies_.scheduling_algorithm_ = SchedulingAlgorithm::kBest;
     }
 
+    data.at("strategies").at("tile_size").get_to(strategies_.tile_size_);
+
+    std::string tile_ordering;
+    data.at("strategies").at("tile_ordering").get_to(tile_ordering);
+    if (tile_ordering == "scanline") {
+      strategies_.tile_ordering_ = TileOrdering::kScanline;
+    } else if (tile_ordering == "morton") {
+      strategies_.tile_ordering_ = TileOrdering::kMorton;
+    } else if (tile_ordering == "spiral") {
+      strategies_.tile_ordering_ = TileOrdering::kSpiral;
+    } else {
+      strategies_.tile_ordering_ = TileOrdering::kDefault;
+    }
+
+    data.at("strategies").at("thread_count").get_to(strategies_.thread_count_);
+    data.at("strategies")
+        .at("thread_affinity")
+        .get_to(strategies_.thread_affinity_);
+
     std::string tone_mapping_algorithm;
     data.at("strategies").at("tone_mapping").get_to(tone_mapping_algorithm);
     if (tone_mapping_algorithm == "clamp") {
@@ -263,6 +336,44 @@ struct Configuration {
     data.at("acceleration")
         .at("bvh_high_level")
         .get_to(acceleration_.bvh_high_level_);
+    data.at("acceleration")
+        .at("packet_traversal")
+        .get_to(acceleration_.packet_traversal_);
+
+    std::string bvh_construction_algorithm;
+    data.at("acceleration")
+        .at("bvh_construction")
+        .get_to(bvh_construction_algorithm);
+    if (bvh_construction_algorithm == "median") {
+      acceleration_.bvh_construction_algorithm_ =
+          BVHConstructionAlgorithm::kMedian;
+    } else if (bvh_construction_algorithm == "sah") {
+      acceleration_.bvh_construction_algorithm_ = BVHConstructionAlgorithm::kSAH;
+    } else if (bvh_construction_algorithm == "lbvh") {
+      acceleration_.bvh_construction_algorithm_ =
+          BVHConstructionAlgorithm::kLBVH;
+    } else if (bvh_construction_algorithm == "lbvh_treelet") {
+      acceleration_.bvh_construction_algorithm_ =
+          BVHConstructionAlgorithm::kTreeletLBVH;
+    } else {
+      acceleration_.bvh_construction_algorithm_ =
+          BVHConstructionAlgorithm::kBest;
+    }
+
+    std::string bvh_layout;
+    data.at("acceleration").at("bvh_layout").get_to(bvh_layout);
+    if (bvh_layout == "binary") {
+      acceleration_.bvh_layout_ = BVHLayout::kBinary;
+    } else if (bvh_layout == "bvh4") {
+      acceleration_.bvh_layout_ = BVHLayout::kBVH4;
+    } else if (bvh_layout == "bvh8") {
+      acceleration_.bvh_layout_ = BVHLayout::kBVH8;
+    } else {
+      acceleration_.bvh_layout_ = BVHLayout::kBest;
+    }
+    data.at("acceleration")
+        .at("bvh_cache_directory")
+        .get_to(acceleration_.bvh_cache_directory_);
 
     data.at("timer").at("parse_xml").get_to(timer_.parse_xml_);
     data.at("timer").at("load_scene").get_to(timer_.load_scene_);
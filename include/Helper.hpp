@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "../extern/parser.h"
+#include "Random.hpp"
 
 using namespace parser;
 
@@ -109,6 +110,18 @@ inline Vec3f bounding_volume_max(std::vector<Vec3f> vertices) {
       })->z};
 }
 
+inline Vec3f component_min(Vec3f a, Vec3f b) {
+  return Vec3f{std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)};
+}
+
+inline Vec3f component_max(Vec3f a, Vec3f b) {
+  return Vec3f{std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)};
+}
+
+inline float component(const Vec3f& a, int axis) {
+  return axis == 0 ? a.x : (axis == 1 ? a.y : a.z);
+}
+
 inline Mat4x4f operator*(Mat4x4f a, Mat4x4f b) {
   Mat4x4f result;
   for (int i = 0; i < 4; i++) {
@@ -218,12 +231,30 @@ inline Mat4x4f operator~(Mat4x4f a) {
   return result;
 }
 
+inline bool is_identity(const Mat4x4f& a) {
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      if (a.m[i][j] != IDENTITY_MATRIX.m[i][j]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
 inline Vec3f operator*(Mat4x4f a, Vec3f b) {
   return Vec3f{a.m[0][0] * b.x + a.m[0][1] * b.y + a.m[0][2] * b.z + a.m[0][3],
                a.m[1][0] * b.x + a.m[1][1] * b.y + a.m[1][2] * b.z + a.m[1][3],
                a.m[2][0] * b.x + a.m[2][1] * b.y + a.m[2][2] * b.z + a.m[2][3]};
 }
 
+// Applies only the linear part of the matrix, for directions and normals
+inline Vec3f transform_direction(const Mat4x4f& a, Vec3f b) {
+  return Vec3f{a.m[0][0] * b.x + a.m[0][1] * b.y + a.m[0][2] * b.z,
+               a.m[1][0] * b.x + a.m[1][1] * b.y + a.m[1][2] * b.z,
+               a.m[2][0] * b.x + a.m[2][1] * b.y + a.m[2][2] * b.z};
+}
+
 inline Mat4x4f translation_matrix(RawTranslation t) {
   return Mat4x4f{
       {{1, 0, 0, t.tx}, {0, 1, 0, t.ty}, {0, 0, 1, t.tz}, {0, 0, 0, 1}}};
@@ -311,87 +342,87 @@ inline Mat4x4f parse_transformation(std::string transformation_text,
 }
 
 template <typename T>
-inline void shuffle(std::vector<T>& samples) {
+inline void shuffle(std::vector<T>& samples, PCG32& random) {
   for (int i = 0; i < samples.size(); i++) {
-    int j = rand() % samples.size();
+    int j = random.NextUInt(samples.size());
     std::swap(samples[i], samples[j]);
   }
 }
 
-inline std::vector<float> uniform_1d(int num_samples) {
+inline std::vector<float> uniform_1d(int num_samples, PCG32& random) {
   std::vector<float> samples;
   for (int i = 0; i < num_samples; i++) {
     samples.push_back((float)i / num_samples);
   }
-  shuffle(samples);
+  shuffle(samples, random);
   return samples;
 }
 
-inline std::vector<Vec2f> uniform_2d(int num_samples) {
+inline std::vector<Vec2f> uniform_2d(int num_samples, PCG32& random) {
   std::vector<Vec2f> samples;
   for (int i = 0; i < num_samples; i++) {
     for (int j = 0; j < num_samples; j++) {
       samples.push_back(Vec2f{(float)i / num_samples, (float)j / num_samples});
     }
   }
-  shuffle(samples);
+  shuffle(samples, random);
   return samples;
 }
 
-inline std::vector<float> uniform_random_1d(int num_samples) {
+inline std::vector<float> uniform_random_1d(int num_samples, PCG32& random) {
   std::vector<float> samples;
   for (int i = 0; i < num_samples; i++) {
-    samples.push_back((float)rand() / RAND_MAX);
+    samples.push_back(random.NextFloat());
   }
-  shuffle(samples);
+  shuffle(samples, random);
   return samples;
 }
 
-inline std::vector<Vec2f> uniform_random_2d(int num_samples) {
+inline std::vector<Vec2f> uniform_random_2d(int num_samples, PCG32& random) {
   std::vector<Vec2f> samples;
   for (int i = 0; i < num_samples; i++) {
     for (int j = 0; j < num_samples; j++) {
       samples.push_back(
-          Vec2f{(float)rand() / RAND_MAX, (float)rand() / RAND_MAX});
+          Vec2f{random.NextFloat(), random.NextFloat()});
     }
   }
-  shuffle(samples);
+  shuffle(samples, random);
   return samples;
 }
 
-inline std::vector<float> jittered_1d(int num_samples) {
+inline std::vector<float> jittered_1d(int num_samples, PCG32& random) {
   std::vector<float> samples;
   for (int i = 0; i < num_samples; i++) {
-    samples.push_back((i + (float)rand() / RAND_MAX) / num_samples);
+    samples.push_back((i + random.NextFloat()) / num_samples);
   }
-  shuffle(samples);
+  shuffle(samples, random);
   return samples;
 }
 
-inline std::vector<Vec2f> jittered_2d(int num_samples) {
+inline std::vector<Vec2f> jittered_2d(int num_samples, PCG32& random) {
   std::vector<Vec2f> samples;
   for (int i = 0; i < num_samples; i++) {
     for (int j = 0; j < num_samples; j++) {
-      samples.push_back(Vec2f{(i + (float)rand() / RAND_MAX) / num_samples,
-                              (j + (float)rand() / RAND_MAX) / num_samples});
+      samples.push_back(Vec2f{(i + random.NextFloat()) / num_samples,
+                              (j + random.NextFloat()) / num_samples});
     }
   }
-  shuffle(samples);
+  shuffle(samples, random);
   return samples;
 }
 
-inline std::vector<Vec2f> multi_jittered_2d(int num_samples) {
+inline std::vector<Vec2f> multi_jittered_2d(int num_samples, PCG32& random) {
   std::vector<Vec2f> samples;
   int n = sqrt(num_samples);
   float subcell_width = 1.0 / num_samples;
   for (int i = 0; i < n; i++) {
     for (int j = 0; j < n; j++) {
       samples.push_back(
-          Vec2f{(i * n + j + (float)rand() / RAND_MAX) * subcell_width,
-                (j * n + i + (float)rand() / RAND_MAX) * subcell_width});
+          Vec2f{(i * n + j + random.NextFloat()) * subcell_width,
+                (j * n + i + random.NextFloat()) * subcell_width});
     }
   }
-  shuffle(samples);
+  shuffle(samples, random);
   return samples;
 }
 
@@ -408,25 +439,25 @@ inline float radical_inverse(unsigned int n, unsigned int base) {
   return val;
 }
 
-inline std::vector<Vec2f> hammersley_2d(int num_samples) {
+inline std::vector<Vec2f> hammersley_2d(int num_samples, PCG32& random) {
   std::vector<Vec2f> samples;
   for (int i = 0; i < num_samples; i++) {
     float x = (float)i / num_samples;
     float y = (float)radical_inverse(i, 2);
     samples.push_back(Vec2f{x, y});
   }
-  shuffle(samples);
+  shuffle(samples, random);
   return samples;
 }
 
-inline std::vector<Vec2f> halton_2d(int num_samples) {
+inline std::vector<Vec2f> halton_2d(int num_samples, PCG32& random) {
   std::vector<Vec2f> samples;
   for (int i = 0; i < num_samples; i++) {
     float x = (float)radical_inverse(i, 2);
     float y = (float)radical_inverse(i, 3);
     samples.push_back(Vec2f{x, y});
   }
-  shuffle(samples);
+  shuffle(samples, random);
   return samples;
 }
 
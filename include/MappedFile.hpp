@@ -0,0 +1,48 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <string>
+
+// Read only memory mapping of a whole file, unmapped once it goes out of scope.
+// Data() is null when the file cannot be opened or is empty.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& filename) {
+    int file_descriptor = open(filename.c_str(), O_RDONLY);
+    if (file_descriptor < 0) {
+      return;
+    }
+    struct stat file_status;
+    if (fstat(file_descriptor, &file_status) == 0 && file_status.st_size > 0) {
+      void* data = mmap(nullptr, file_status.st_size, PROT_READ, MAP_PRIVATE,
+                        file_descriptor, 0);
+      if (data != MAP_FAILED) {
+        data_ = static_cast<const char*>(data);
+        size_ = file_status.st_size;
+        // The whole file is read front to back
+        madvise(data, size_, MADV_SEQUENTIAL);
+      }
+    }
+    close(file_descriptor);
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+    if (data_) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+  }
+
+  const char* Data() const { return data_; }
+  size_t Size() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
\ No newline at end of file
@@ -4,6 +4,10 @@
 #include "BoundingVolumeHierarchy.hpp"
 #include "MeshObject.hpp"
 
+// An instance is a transform over a shared mesh, the scene BVH is the top
+// level over the instances and the BVH of the mesh the bottom level all its
+// instances share. Rays are moved into the object space of the mesh and only
+// the transform, the material and the bounds are stored per instance.
 class MeshInstanceObject : public BaseObject {
  public:
   MeshInstanceObject(std::shared_ptr<BaseMaterial> material,
@@ -11,15 +15,15 @@ class MeshInstanceObject : public BaseObject {
                      const Mat4x4f& transform_matrix,
                      RawScalingFlip scaling_flip);
 
-  std::shared_ptr<BoundingVolumeHierarchyElement> Intersect(
-      Ray& ray, float& t_hit, Vec3f& intersection_normal,
-      bool backface_culling = true,
-      bool stop_at_any_hit = false) const override;
+  bool Intersect(const Ray& ray, HitRecord& hit, bool backface_culling = true,
+                 bool stop_at_any_hit = false) const override;
+  bool Occluded(const Ray& ray, float t_max) const override;
 
   virtual ~MeshInstanceObject() = default;
 
   void Preprocess(bool high_level_bvh_enabled, bool low_level_bvh_enabled,
-                  bool transform_enabled = true) override;
+                  bool transform_enabled = true,
+                  ThreadPool* thread_pool = nullptr) override;
 
  private:
   std::shared_ptr<MeshObject> mesh_object_;
@@ -2,6 +2,7 @@
 
 #include "BaseObject.hpp"
 #include "BoundingVolumeHierarchy.hpp"
+#include "TriangleBlock.hpp"
 #include "TriangleObject.hpp"
 
 class MeshObject : public BaseObject {
@@ -9,21 +10,97 @@ class MeshObject : public BaseObject {
   MeshObject(std::shared_ptr<BaseMaterial> material,
              const std::vector<RawFace>& raw_face_data,
              const std::vector<Vec3f>& raw_vertex_data, const Vec3f motion_blur,
-             const Mat4x4f& transform_matrix, RawScalingFlip scaling_flip);
+             const Mat4x4f& transform_matrix, RawScalingFlip scaling_flip,
+             const BVHConstructionAlgorithm bvh_construction_algorithm =
+                 BVHConstructionAlgorithm::kBest,
+             const BVHLayout bvh_layout = BVHLayout::kBest);
+  // Meshes given a bvh_cache_directory look for a cache file of the PLY file
+  // and their BVH settings there. A hit skips parsing the PLY file and
+  // building the BVH, otherwise the file is written once the BVH is built.
   MeshObject(std::shared_ptr<BaseMaterial> material,
              const std::string& ply_filename, const Vec3f motion_blur,
-             const Mat4x4f& transform_matrix, RawScalingFlip scaling_flip);
+             const Mat4x4f& transform_matrix, RawScalingFlip scaling_flip,
+             const BVHConstructionAlgorithm bvh_construction_algorithm =
+                 BVHConstructionAlgorithm::kBest,
+             const BVHLayout bvh_layout = BVHLayout::kBest,
+             const std::string& bvh_cache_directory = "");
 
-  std::shared_ptr<BoundingVolumeHierarchyElement> Intersect(
-      Ray& ray, float& t_hit, Vec3f& intersection_normal,
-      bool backface_culling = true,
-      bool stop_at_any_hit = false) const override;
+  bool Intersect(const Ray& ray, HitRecord& hit, bool backface_culling = true,
+                 bool stop_at_any_hit = false) const override;
+  bool Occluded(const Ray& ray, float t_max) const override;
+  void IntersectPacket(RayPacket& packet, uint32_t lane_mask, HitRecord* hits,
+                       bool backface_culling = true) const override;
 
   virtual ~MeshObject() = default;
 
   void Preprocess(bool high_level_bvh_enabled, bool low_level_bvh_enabled,
-                  bool transform_enabled = true) override;
+                  bool transform_enabled = true,
+                  ThreadPool* thread_pool = nullptr) override;
 
-  std::vector<std::shared_ptr<BoundingVolumeHierarchyElement>>
-      triangle_objects_;
+  // Closest and any hit queries against the triangles in object space, shared
+  // with the instances of the mesh. The closest hit in front of t_max is
+  // reported as a triangle and its kernel result, callers turn it into world
+  // space once.
+  bool IntersectTriangles(const Ray& ray, float t_max, bool backface_culling,
+                          bool stop_at_any_hit, uint32_t& triangle,
+                          TriangleHit& hit) const;
+  bool OccludedTriangles(const Ray& ray, float t_max) const;
+  Vec3f TriangleNormal(uint32_t triangle) const;
+
+  size_t TriangleCount() const { return indices_.size() / 3; }
+
+  // Indexed triangle mesh, every three indices form a triangle. Once the BVH
+  // is built the triangles are stored in its leaf order, with the padding
+  // slots of the leaves as degenerate triangles that are never hit.
+  std::vector<Vec3f> vertices_;
+  std::vector<uint32_t> indices_;
+  std::shared_ptr<BoundingVolumeHierarchy> bvh_ = nullptr;
+  // Object space bounds of the triangles, the root of bvh_ once it is built.
+  // Instances transform its eight corners into their own world space bounds.
+  Vec3f object_min_point_;
+  Vec3f object_max_point_;
+  // The slots in blocks of triangle_block_width_, the single ray queries test
+  // every BVH leaf with one kernel call on the block it starts
+  std::vector<float> triangle_blocks_;
+  int triangle_block_width_ = 1;
+
+ private:
+  // Reads a binary little endian PLY file mapped at data with bulk copies
+  // instead of the generic reader, returns false for the files it does not
+  // support
+  bool LoadBinaryPLY(const char* data, size_t size);
+  void BuildTriangleBlocks();
+  // The triangles in leaf order, the BVH nodes and the triangle blocks are
+  // loaded from the cache file or saved to it, keyed by cache_key_
+  bool LoadCache();
+  void SaveCache() const;
+  int IntersectLeafBlock(uint32_t first_slot, const Ray& ray,
+                         bool backface_culling, float t_closest,
+                         TriangleHit& hit) const {
+    return IntersectTriangleBlock(
+        triangle_blocks_.data() + kTriangleBlockComponents * first_slot,
+        triangle_block_width_, ray, backface_culling, t_closest, hit);
+  }
+  bool IntersectTriangle(uint32_t triangle, const Ray& ray,
+                         bool backface_culling, TriangleHit& hit) const {
+    return ::IntersectTriangle(vertices_[indices_[3 * triangle]],
+                               vertices_[indices_[3 * triangle + 1]],
+                               vertices_[indices_[3 * triangle + 2]], ray,
+                               backface_culling, hit);
+  }
+  uint32_t IntersectTrianglePacket(uint32_t triangle, RayPacket& packet,
+                                   uint32_t lane_mask, bool backface_culling,
+                                   TriangleHit* lane_hits) const {
+    return ::IntersectTrianglePacket(
+        vertices_[indices_[3 * triangle]],
+        vertices_[indices_[3 * triangle + 1]],
+        vertices_[indices_[3 * triangle + 2]], packet, lane_mask,
+        backface_culling, lane_hits);
+  }
+
+  const BVHConstructionAlgorithm bvh_construction_algorithm_;
+  const BVHLayout bvh_layout_;
+  // Empty without a cache
+  std::string cache_filename_;
+  uint64_t cache_key_ = 0;
 };
\ No newline at end of file
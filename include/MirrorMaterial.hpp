@@ -7,11 +7,18 @@ using namespace parser;
 
 class MirrorMaterial : public BaseMaterial {
  public:
-  MirrorMaterial(const Vec3f& ambient, const Vec3f& diffuse,
+  MirrorMaterial(int id, const Vec3f& ambient, const Vec3f& diffuse,
                  const Vec3f& specular, float phong_exponent, float roughness,
                  const Vec3f& mirror)
-      : BaseMaterial(ambient, diffuse, specular, phong_exponent, roughness),
+      : BaseMaterial(id, ambient, diffuse, specular, phong_exponent, roughness,
+                     MaterialType::kMirror),
         mirror_(mirror) {}
 
+  MaterialRecord Record() const override {
+    MaterialRecord record = BaseMaterial::Record();
+    record.mirror_ = mirror_;
+    return record;
+  }
+
   const Vec3f mirror_;
 };
\ No newline at end of file
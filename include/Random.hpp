@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+#include "../extern/parser.h"
+
+using namespace parser;
+
+// Scrambles the bits of a 64 bit value (splitmix64 finalizer), so that
+// neighbouring indices give unrelated seeds
+inline uint64_t mix_bits(uint64_t value) {
+  value ^= value >> 31;
+  value *= 0x7fb5d329728ea185ULL;
+  value ^= value >> 27;
+  value *= 0x81dadef4bc2dd44dULL;
+  value ^= value >> 33;
+  return value;
+}
+
+// Maps the upper 24 bits of a value to a float in [0, 1)
+inline float unit_float(uint32_t value) {
+  return (value >> 8) * (1.0f / 16777216.0f);
+}
+
+inline uint64_t pixel_seed(const Vec2i& pixel) {
+  return mix_bits((uint64_t(uint32_t(pixel.x)) << 32) | uint32_t(pixel.y));
+}
+
+// PCG32 generator, small enough to live on the stack of whoever samples. A
+// generator is created for every pixel sample from its indices, so no state
+// is shared between threads and renders do not depend on the scheduling.
+class PCG32 {
+ public:
+  PCG32(uint64_t seed, uint64_t stream = 0)
+      : state_(0), increment_((stream << 1) | 1) {
+    NextUInt();
+    state_ += seed;
+    NextUInt();
+  }
+
+  uint32_t NextUInt() {
+    uint64_t old_state = state_;
+    state_ = old_state * 6364136223846793005ULL + increment_;
+    uint32_t xor_shifted = uint32_t(((old_state >> 18) ^ old_state) >> 27);
+    uint32_t rotation = uint32_t(old_state >> 59);
+    return (xor_shifted >> rotation) | (xor_shifted << ((32 - rotation) & 31));
+  }
+
+  // Uniform in [0, bound)
+  uint32_t NextUInt(uint32_t bound) { return NextUInt() % bound; }
+
+  // Uniform in [0, 1)
+  float NextFloat() { return unit_float(NextUInt()); }
+
+ private:
+  uint64_t state_;
+  uint64_t increment_;
+};
\ No newline at end of file
@@ -1,4 +1,6 @@
 #pragma once
+#include <cmath>
+
 #include "../extern/parser.h"
 #include "Helper.hpp"
 
@@ -6,17 +8,32 @@ using namespace parser;
 
 class Ray {
  public:
+  Ray() : Ray({0, 0}, {0, 0, 0}, {0, 0, 1}) {}
   Ray(const Vec2i& pixel, const Vec3f origin, Vec3f direction,
       Vec2f diff = {0.0, 0.0}, float time = 0.0)
-      : pixel_(pixel),
-        origin_(origin),
-        direction_(direction),
-        diff_(diff),
-        time_(time) {}
-  const Vec2i pixel_;
-  const Vec3f origin_;
+      : pixel_(pixel), origin_(origin), diff_(diff), time_(time) {
+    SetDirection(direction);
+  }
+
+  // Keeps the reciprocal direction and the direction signs used by the slab
+  // tests in sync with the direction. The signs come from the sign bits, so a
+  // -0 component, whose reciprocal is -inf, takes the max plane as its near
+  // plane like any other negative one.
+  void SetDirection(const Vec3f& direction) {
+    direction_ = direction;
+    inverse_direction_ = Vec3f{1.0f / direction.x, 1.0f / direction.y,
+                               1.0f / direction.z};
+    direction_negative_[0] = std::signbit(direction.x);
+    direction_negative_[1] = std::signbit(direction.y);
+    direction_negative_[2] = std::signbit(direction.z);
+  }
+
+  Vec2i pixel_;
+  Vec3f origin_;
   Vec3f direction_;
-  const Vec2f diff_;
-  const float time_;
+  Vec3f inverse_direction_;
+  bool direction_negative_[3];
+  Vec2f diff_;
+  float time_;
   ~Ray() {}
 };
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <limits>
+
+#include "Ray.hpp"
+#include "Simd.hpp"
+
+const int kRayPacketWidth = kSimdWidth;
+
+// Rays of a packet in SoA layout, so that the packet kernels test a box or a
+// triangle against all of them at once. Lanes are addressed by bit masks,
+// lane i by bit i.
+struct RayPacket {
+  // Copies up to kRayPacketWidth rays. The unused lanes repeat the first ray
+  // with an empty range, so they never hit anything.
+  void Load(const Ray* rays, int ray_count) {
+    ray_count_ = ray_count;
+    coherent_ = true;
+    for (int axis = 0; axis < 3; axis++) {
+      direction_negative_[axis] = rays[0].direction_negative_[axis];
+    }
+    for (int lane = 0; lane < kRayPacketWidth; lane++) {
+      const Ray& ray = rays[lane < ray_count ? lane : 0];
+      rays_[lane] = &ray;
+      origin_[0][lane] = ray.origin_.x;
+      origin_[1][lane] = ray.origin_.y;
+      origin_[2][lane] = ray.origin_.z;
+      direction_[0][lane] = ray.direction_.x;
+      direction_[1][lane] = ray.direction_.y;
+      direction_[2][lane] = ray.direction_.z;
+      inverse_direction_[0][lane] = ray.inverse_direction_.x;
+      inverse_direction_[1][lane] = ray.inverse_direction_.y;
+      inverse_direction_[2][lane] = ray.inverse_direction_.z;
+      t_closest_[lane] = lane < ray_count
+                             ? std::numeric_limits<float>::max()
+                             : -std::numeric_limits<float>::max();
+      for (int axis = 0; axis < 3; axis++) {
+        coherent_ = coherent_ && ray.direction_negative_[axis] ==
+                                     direction_negative_[axis];
+      }
+    }
+  }
+
+  uint32_t ActiveMask() const { return (1u << ray_count_) - 1; }
+
+  float origin_[3][kRayPacketWidth];
+  float direction_[3][kRayPacketWidth];
+  float inverse_direction_[3][kRayPacketWidth];
+  // Distance to the closest hit so far, it bounds the traversal of every lane
+  float t_closest_[kRayPacketWidth];
+  const Ray* rays_[kRayPacketWidth];
+  int ray_count_;
+  // Direction signs of the first ray. The packet traversal picks the slab
+  // planes with them, so it only takes coherent packets whose rays all share
+  // these signs.
+  bool direction_negative_[3];
+  bool coherent_;
+};
\ No newline at end of file
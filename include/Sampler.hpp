@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "../extern/parser.h"
+#include "Configuration.hpp"
+
+using namespace parser;
+
+// Sample pattern that is built once at startup. Every pixel or shading point
+// passes its own seed and gets a decorrelated version of the pattern by
+// hashing the seed into a scramble of the stored points, so nothing is
+// generated or shuffled per pixel. The stratified patterns are shifted
+// toroidally, Sobol points get a random digit scramble and Owen scrambled
+// Sobol points a hash based nested uniform scramble.
+class Sampler {
+ public:
+  Sampler() = default;
+  // dimension_count is 1 for time samples and 2 for pixel, aperture and area
+  // light samples
+  Sampler(const SamplingAlgorithm sampling_algorithm, const int sample_count,
+          const int dimension_count);
+
+  float Get1D(int sample_index, uint64_t seed) const;
+  Vec2f Get2D(int sample_index, uint64_t seed) const;
+
+  int sample_count_ = 0;
+
+ private:
+  uint32_t Scramble(uint32_t value, uint32_t scramble) const;
+
+  SamplingAlgorithm sampling_algorithm_ = SamplingAlgorithm::kRandom;
+  // Points in 0.32 fixed point, so that shifts wrap around for free
+  std::vector<uint32_t> x_;
+  std::vector<uint32_t> y_;
+};
\ No newline at end of file
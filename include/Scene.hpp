@@ -22,7 +22,9 @@
 #include "PointLightSource.hpp"
 #include "STBExporter.hpp"
 #include "SphereObject.hpp"
+#include "ThreadPool.hpp"
 #include "TriangleObject.hpp"
+#include "Wavefront.hpp"
 
 using namespace parser;
 
@@ -48,38 +50,63 @@ class Scene {
   std::vector<std::shared_ptr<AreaLightSource>> area_lights_;
   std::vector<std::shared_ptr<AmbientLightSource>> ambient_lights_;
   std::vector<std::shared_ptr<BaseMaterial>> materials_;
+  // Flat copy of the materials for shading, indexed by material id
+  std::vector<MaterialRecord> material_records_;
   std::vector<std::shared_ptr<BoundingVolumeHierarchyElement>> objects_;
 
   std::vector<std::shared_ptr<BaseImage>> images_;
   std::vector<std::shared_ptr<BaseTextureMap>> texture_maps_;
 
-  std::shared_ptr<BoundingVolumeHierarchyElement> bvh_root_ = nullptr;
+  std::shared_ptr<BoundingVolumeHierarchy> bvh_root_ = nullptr;
 
   std::function<void(const std::shared_ptr<BaseCamera>, int)>
       scheduling_algorithm_;
-  std::function<Vec3f(Ray &, const std::shared_ptr<BaseObject>, int, int)>
+  std::function<Vec3f(const Ray &, const BoundingVolumeHierarchyElement *,
+                      int, int, int, PCG32 &, const HitRecord *)>
       ray_tracing_algorithm_;
   std::function<void(Vec5f *, int, int, int, Vec3f *)> filtering_algorithm_;
   std::function<void(Vec3f *, int, int, std::vector<unsigned char> &)>
       tone_mapping_algorithm_;
 
-  std::function<std::vector<Vec2f>(int)> area_light_sampling_algorithm_;
+  // Holds one sample per camera sample, rebuilt for every camera. A path looks
+  // up its own sample index, scrambled per pixel and light, so the samples of
+  // a pixel are stratified over each area light.
+  Sampler area_light_sampler_;
 
   std::shared_ptr<BaseExporter> exporter_;
 
+  // Shared by ray tracing, filtering, tone mapping and exporting of all cameras
+  std::shared_ptr<ThreadPool> thread_pool_;
+
   Vec3f DefaultRayTracingAlgorithm(
-      Ray &ray,
-      const std::shared_ptr<BoundingVolumeHierarchyElement> inside_object_ptr,
-      int, int);
+      const Ray &ray, const BoundingVolumeHierarchyElement *inside_object_ptr,
+      int, int, int, PCG32 &, const HitRecord *);
+  // sample_index is the index of the camera sample the path belongs to and
+  // random is its generator, every bounce of the path draws from it in turn. A camera ray that was already intersected as part
+  // of a packet passes its hit, other rays pass nullptr. inside_object_ptr is
+  // the dielectric the ray travels through, owned by objects_.
   Vec3f RecursiveRayTracingAlgorithm(
-      Ray &ray,
-      const std::shared_ptr<BoundingVolumeHierarchyElement> inside_object_ptr,
-      int remaining_recursion, int max_recursion);
+      const Ray &ray, const BoundingVolumeHierarchyElement *inside_object_ptr,
+      int remaining_recursion, int max_recursion, int sample_index,
+      PCG32 &random, const HitRecord *primary_hit);
+
+  // Traces all the samples of a tile breadth first, one bounce of every path
+  // per wave, and writes them to the camera. Used instead of
+  // ray_tracing_algorithm_ by the schedulers when the configuration asks for
+  // it, queues holds the storage of the calling worker.
+  void WavefrontRayTracingAlgorithm(const std::shared_ptr<BaseCamera> camera,
+                                    int camera_index, const Tile &tile,
+                                    WavefrontQueues &queues);
+
+  // Finds the closest hits of the camera rays of a pixel in packets
+  void IntersectPrimaryRays(const Ray *rays, int ray_count, HitRecord *hits);
 
   void NonThreadSchedulingAlgorithm(const std::shared_ptr<BaseCamera> camera,
                                     int camera_index);
   void ThreadQueueSchedulingAlgorithm(const std::shared_ptr<BaseCamera> camera,
                                       int camera_index);
+  void WorkStealingSchedulingAlgorithm(const std::shared_ptr<BaseCamera> camera,
+                                       int camera_index);
 
   void AveragingFilterAlgorithm(Vec5f *image_sampled_data, int image_width,
                                 int image_height, int sample,
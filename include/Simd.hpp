@@ -0,0 +1,226 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Float vector and lane mask used by the packet kernels. They are 8 wide when
+// built with AVX2, 4 wide with SSE and plain arrays of 4 elsewhere, so the
+// kernels are written once for every width.
+
+#if defined(__AVX2__)
+
+const int kSimdWidth = 8;
+
+struct SimdMask {
+  __m256 value_;
+};
+
+struct SimdFloat {
+  SimdFloat() = default;
+  SimdFloat(__m256 value) : value_(value) {}
+  explicit SimdFloat(float value) : value_(_mm256_set1_ps(value)) {}
+
+  static SimdFloat Load(const float* values) {
+    return _mm256_loadu_ps(values);
+  }
+  void Store(float* values) const { _mm256_storeu_ps(values, value_); }
+
+  __m256 value_;
+};
+
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) {
+  return _mm256_add_ps(a.value_, b.value_);
+}
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) {
+  return _mm256_sub_ps(a.value_, b.value_);
+}
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) {
+  return _mm256_mul_ps(a.value_, b.value_);
+}
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) {
+  return _mm256_div_ps(a.value_, b.value_);
+}
+// Like a < b ? a : b, the second operand wins when either one is NaN
+inline SimdFloat simd_min(SimdFloat a, SimdFloat b) {
+  return _mm256_min_ps(a.value_, b.value_);
+}
+// Like a > b ? a : b, the second operand wins when either one is NaN
+inline SimdFloat simd_max(SimdFloat a, SimdFloat b) {
+  return _mm256_max_ps(a.value_, b.value_);
+}
+inline SimdMask operator<(SimdFloat a, SimdFloat b) {
+  return {_mm256_cmp_ps(a.value_, b.value_, _CMP_LT_OQ)};
+}
+inline SimdMask operator<=(SimdFloat a, SimdFloat b) {
+  return {_mm256_cmp_ps(a.value_, b.value_, _CMP_LE_OQ)};
+}
+inline SimdMask operator>(SimdFloat a, SimdFloat b) {
+  return {_mm256_cmp_ps(a.value_, b.value_, _CMP_GT_OQ)};
+}
+inline SimdMask operator>=(SimdFloat a, SimdFloat b) {
+  return {_mm256_cmp_ps(a.value_, b.value_, _CMP_GE_OQ)};
+}
+inline SimdMask operator&(SimdMask a, SimdMask b) {
+  return {_mm256_and_ps(a.value_, b.value_)};
+}
+inline SimdMask operator|(SimdMask a, SimdMask b) {
+  return {_mm256_or_ps(a.value_, b.value_)};
+}
+inline SimdFloat simd_select(SimdMask mask, SimdFloat a, SimdFloat b) {
+  return _mm256_blendv_ps(b.value_, a.value_, mask.value_);
+}
+// One bit per lane, lane 0 in the lowest bit
+inline uint32_t simd_mask_bits(SimdMask mask) {
+  return _mm256_movemask_ps(mask.value_);
+}
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+const int kSimdWidth = 4;
+
+struct SimdMask {
+  __m128 value_;
+};
+
+struct SimdFloat {
+  SimdFloat() = default;
+  SimdFloat(__m128 value) : value_(value) {}
+  explicit SimdFloat(float value) : value_(_mm_set1_ps(value)) {}
+
+  static SimdFloat Load(const float* values) { return _mm_loadu_ps(values); }
+  void Store(float* values) const { _mm_storeu_ps(values, value_); }
+
+  __m128 value_;
+};
+
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) {
+  return _mm_add_ps(a.value_, b.value_);
+}
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) {
+  return _mm_sub_ps(a.value_, b.value_);
+}
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) {
+  return _mm_mul_ps(a.value_, b.value_);
+}
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) {
+  return _mm_div_ps(a.value_, b.value_);
+}
+inline SimdFloat simd_min(SimdFloat a, SimdFloat b) {
+  return _mm_min_ps(a.value_, b.value_);
+}
+inline SimdFloat simd_max(SimdFloat a, SimdFloat b) {
+  return _mm_max_ps(a.value_, b.value_);
+}
+inline SimdMask operator<(SimdFloat a, SimdFloat b) {
+  return {_mm_cmplt_ps(a.value_, b.value_)};
+}
+inline SimdMask operator<=(SimdFloat a, SimdFloat b) {
+  return {_mm_cmple_ps(a.value_, b.value_)};
+}
+inline SimdMask operator>(SimdFloat a, SimdFloat b) {
+  return {_mm_cmpgt_ps(a.value_, b.value_)};
+}
+inline SimdMask operator>=(SimdFloat a, SimdFloat b) {
+  return {_mm_cmpge_ps(a.value_, b.value_)};
+}
+inline SimdMask operator&(SimdMask a, SimdMask b) {
+  return {_mm_and_ps(a.value_, b.value_)};
+}
+inline SimdMask operator|(SimdMask a, SimdMask b) {
+  return {_mm_or_ps(a.value_, b.value_)};
+}
+inline SimdFloat simd_select(SimdMask mask, SimdFloat a, SimdFloat b) {
+  return _mm_or_ps(_mm_and_ps(mask.value_, a.value_),
+                   _mm_andnot_ps(mask.value_, b.value_));
+}
+inline uint32_t simd_mask_bits(SimdMask mask) {
+  return _mm_movemask_ps(mask.value_);
+}
+
+#else
+
+const int kSimdWidth = 4;
+
+struct SimdMask {
+  bool value_[kSimdWidth];
+};
+
+struct SimdFloat {
+  SimdFloat() = default;
+  explicit SimdFloat(float value) {
+    for (int i = 0; i < kSimdWidth; i++) value_[i] = value;
+  }
+
+  static SimdFloat Load(const float* values) {
+    SimdFloat result;
+    for (int i = 0; i < kSimdWidth; i++) result.value_[i] = values[i];
+    return result;
+  }
+  void Store(float* values) const {
+    for (int i = 0; i < kSimdWidth; i++) values[i] = value_[i];
+  }
+
+  float value_[kSimdWidth];
+};
+
+#define SIMD_FLOAT_OPERATOR(name, expression)          \
+  inline SimdFloat name(SimdFloat a, SimdFloat b) {    \
+    SimdFloat result;                                  \
+    for (int i = 0; i < kSimdWidth; i++) {             \
+      float x = a.value_[i];                           \
+      float y = b.value_[i];                           \
+      result.value_[i] = expression;                   \
+    }                                                  \
+    return result;                                     \
+  }
+#define SIMD_MASK_OPERATOR(name, type, expression) \
+  inline SimdMask name(type a, type b) {           \
+    SimdMask result;                               \
+    for (int i = 0; i < kSimdWidth; i++) {         \
+      auto x = a.value_[i];                        \
+      auto y = b.value_[i];                        \
+      result.value_[i] = expression;               \
+    }                                              \
+    return result;                                 \
+  }
+
+SIMD_FLOAT_OPERATOR(operator+, x + y)
+SIMD_FLOAT_OPERATOR(operator-, x - y)
+SIMD_FLOAT_OPERATOR(operator*, x * y)
+SIMD_FLOAT_OPERATOR(operator/, x / y)
+SIMD_FLOAT_OPERATOR(simd_min, x < y ? x : y)
+SIMD_FLOAT_OPERATOR(simd_max, x > y ? x : y)
+SIMD_MASK_OPERATOR(operator<, SimdFloat, x < y)
+SIMD_MASK_OPERATOR(operator<=, SimdFloat, x <= y)
+SIMD_MASK_OPERATOR(operator>, SimdFloat, x > y)
+SIMD_MASK_OPERATOR(operator>=, SimdFloat, x >= y)
+SIMD_MASK_OPERATOR(operator&, SimdMask, x && y)
+SIMD_MASK_OPERATOR(operator|, SimdMask, x || y)
+
+#undef SIMD_FLOAT_OPERATOR
+#undef SIMD_MASK_OPERATOR
+
+inline SimdFloat simd_select(SimdMask mask, SimdFloat a, SimdFloat b) {
+  SimdFloat result;
+  for (int i = 0; i < kSimdWidth; i++) {
+    result.value_[i] = mask.value_[i] ? a.value_[i] : b.value_[i];
+  }
+  return result;
+}
+inline uint32_t simd_mask_bits(SimdMask mask) {
+  uint32_t bits = 0;
+  for (int i = 0; i < kSimdWidth; i++) {
+    bits |= uint32_t(mask.value_[i]) << i;
+  }
+  return bits;
+}
+
+#endif
+
+// Index of the lowest set lane of a non-empty lane mask
+inline int lowest_lane(uint32_t lane_mask) { return __builtin_ctz(lane_mask); }
\ No newline at end of file
@@ -12,14 +12,15 @@ class SphereObject : public BaseObject {
         center_(center),
         radius_(radius) {};
 
-  std::shared_ptr<BoundingVolumeHierarchyElement> Intersect(
-      Ray& ray, float& t_hit, Vec3f& intersection_normal, bool,
-      bool) const override;
+  bool Intersect(const Ray& ray, HitRecord& hit, bool backface_culling = true,
+                 bool stop_at_any_hit = false) const override;
+  bool Occluded(const Ray& ray, float t_max) const override;
 
   virtual ~SphereObject() = default;
 
   void Preprocess(bool high_level_bvh_enabled, bool low_level_bvh_enabled,
-                  bool transform_enabled = true) override;
+                  bool transform_enabled = true,
+                  ThreadPool* thread_pool = nullptr) override;
 
  private:
   const float radius_;
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the unfinished tasks submitted with it, so that a stage waits for its
+// own tasks only and not for the ones other stages left on the pool
+class TaskGroup {
+ private:
+  friend class ThreadPool;
+  size_t pending_task_count_ = 0;
+};
+
+// Fixed set of worker threads shared by every stage of the rendering. Tasks
+// start in submission order.
+class ThreadPool {
+ public:
+  // A thread count of 0 uses one thread per processor the process may run on,
+  // pinning binds every worker to one of these processors
+  ThreadPool(size_t thread_count = 0, bool pin_threads = false);
+  ~ThreadPool();
+
+  void Submit(TaskGroup& group, std::function<void()> task);
+  // Returns once all tasks of group have finished. The calling thread runs the
+  // queued tasks of group meanwhile, so a task may wait on its own group.
+  void Wait(TaskGroup& group);
+  // Runs body for every index in [begin, end) in chunks of chunk_size indices
+  // and returns once all of them are done, may be called from a task
+  void ParallelFor(int begin, int end, int chunk_size,
+                   const std::function<void(int)>& body);
+
+  size_t Size() const { return threads_.size(); }
+
+ private:
+  struct Task {
+    std::function<void()> function_;
+    TaskGroup* group_;
+  };
+
+  void WorkerLoop();
+  // Removes the task from the queue and runs it with the lock released, the
+  // lock is held on entry and on return
+  void RunTask(std::unique_lock<std::mutex>& lock,
+               std::deque<Task>::iterator task);
+
+  std::vector<std::thread> threads_;
+  std::deque<Task> tasks_;
+  std::mutex mutex_;
+  std::condition_variable task_available_;
+  std::condition_variable group_finished_;
+  bool stopping_ = false;
+};
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+
+#include "Ray.hpp"
+#include "TriangleObject.hpp"
+
+// Triangles of a BVH leaf in SoA layout, so one kernel call tests a ray
+// against all of them. A block of width W holds W lanes of each of the nine
+// components v0.xyz, edge1.xyz = (v1 - v0).xyz and edge2.xyz = (v2 - v0).xyz,
+// one component after the other. The edges are computed once here instead of
+// for every ray, and degenerate triangles pad the leaves that are not full.
+const int kTriangleBlockComponents = 9;
+
+// Block width the kernels of the running CPU work on, 8 with AVX2 and 4 with
+// SSE4.1 and elsewhere. It is detected at runtime, so one build runs on both.
+int TriangleBlockWidth();
+
+// Appends a block of block_width triangles, vertex i of lane j being
+// vertices[3 * j + i]
+void AppendTriangleBlock(const Vec3f* vertices, int block_width,
+                         std::vector<float>& blocks);
+
+// Reads back the triangle of one lane of a block
+inline void TriangleBlockLane(const float* block, int block_width, int lane,
+                              Vec3f& v0, Vec3f& edge1, Vec3f& edge2) {
+  v0 = {block[0 * block_width + lane], block[1 * block_width + lane],
+        block[2 * block_width + lane]};
+  edge1 = {block[3 * block_width + lane], block[4 * block_width + lane],
+           block[5 * block_width + lane]};
+  edge2 = {block[6 * block_width + lane], block[7 * block_width + lane],
+           block[8 * block_width + lane]};
+}
+
+// Closest hit of the ray in front of t_closest among the lanes of a block,
+// returns its lane and fills hit or returns -1. Ties go to the lowest lane,
+// like testing the triangles one by one with IntersectTriangle.
+int IntersectTriangleBlock(const float* block, int block_width,
+                           const Ray& ray, bool backface_culling,
+                           float t_closest, TriangleHit& hit);
\ No newline at end of file
@@ -3,6 +3,123 @@
 #include "BaseObject.hpp"
 #include "Helper.hpp"
 
+// Object space hit of the triangle kernel, t is in units of the ray direction
+// and (u, v) are the barycentric weights of the second and third vertices
+struct TriangleHit {
+  float t_;
+  float u_;
+  float v_;
+};
+
+// Moller-Trumbore without any transform, the owner of the triangle turns the
+// hit into world space once it is known to be the closest one. The triangle
+// is given by its first vertex and the edges towards the other two.
+inline bool IntersectTriangleEdges(const Vec3f& v0, const Vec3f& edge1,
+                                   const Vec3f& edge2, const Ray& ray,
+                                   bool backface_culling, TriangleHit& hit) {
+  Vec3f ray_cross_e2 = cross(ray.direction_, edge2);
+  float det = dot(edge1, ray_cross_e2);
+
+  // det is the negated dot product of the direction and the face normal
+  if (backface_culling && det < 0) {
+    return false;
+  }
+
+  float inv_det = 1.0 / det;
+  Vec3f s = ray.origin_ - v0;
+  float u = inv_det * dot(s, ray_cross_e2);
+
+  if (u < 0 || u > 1) {
+    return false;
+  }
+
+  Vec3f s_cross_e1 = cross(s, edge1);
+  float v = inv_det * dot(ray.direction_, s_cross_e1);
+
+  if (v < 0 || u + v > 1) {
+    return false;
+  }
+
+  hit.t_ = inv_det * dot(edge2, s_cross_e1);
+  hit.u_ = u;
+  hit.v_ = v;
+
+  return hit.t_ > 1e-5;
+}
+
+inline bool IntersectTriangle(const Vec3f& v0, const Vec3f& v1,
+                              const Vec3f& v2, const Ray& ray,
+                              bool backface_culling, TriangleHit& hit) {
+  return IntersectTriangleEdges(v0, v1 - v0, v2 - v0, ray, backface_culling,
+                                hit);
+}
+
+// IntersectTriangle for the lanes of lane_mask at once. Returns the lanes
+// whose closest hit the triangle is, lowers their t_closest_ and writes their
+// kernel results to lane_hits.
+inline uint32_t IntersectTrianglePacket(const Vec3f& v0, const Vec3f& v1,
+                                        const Vec3f& v2, RayPacket& packet,
+                                        uint32_t lane_mask,
+                                        bool backface_culling,
+                                        TriangleHit* lane_hits) {
+  Vec3f edge1 = v1 - v0;
+  Vec3f edge2 = v2 - v0;
+  SimdFloat edge1_x(edge1.x), edge1_y(edge1.y), edge1_z(edge1.z);
+  SimdFloat edge2_x(edge2.x), edge2_y(edge2.y), edge2_z(edge2.z);
+  SimdFloat direction_x = SimdFloat::Load(packet.direction_[0]);
+  SimdFloat direction_y = SimdFloat::Load(packet.direction_[1]);
+  SimdFloat direction_z = SimdFloat::Load(packet.direction_[2]);
+
+  SimdFloat ray_cross_e2_x = direction_y * edge2_z - direction_z * edge2_y;
+  SimdFloat ray_cross_e2_y = direction_z * edge2_x - direction_x * edge2_z;
+  SimdFloat ray_cross_e2_z = direction_x * edge2_y - direction_y * edge2_x;
+  SimdFloat det = edge1_x * ray_cross_e2_x + edge1_y * ray_cross_e2_y +
+                  edge1_z * ray_cross_e2_z;
+
+  SimdFloat inv_det = SimdFloat(1.0f) / det;
+  SimdFloat s_x = SimdFloat::Load(packet.origin_[0]) - SimdFloat(v0.x);
+  SimdFloat s_y = SimdFloat::Load(packet.origin_[1]) - SimdFloat(v0.y);
+  SimdFloat s_z = SimdFloat::Load(packet.origin_[2]) - SimdFloat(v0.z);
+  SimdFloat u = inv_det * (s_x * ray_cross_e2_x + s_y * ray_cross_e2_y +
+                           s_z * ray_cross_e2_z);
+
+  SimdFloat s_cross_e1_x = s_y * edge1_z - s_z * edge1_y;
+  SimdFloat s_cross_e1_y = s_z * edge1_x - s_x * edge1_z;
+  SimdFloat s_cross_e1_z = s_x * edge1_y - s_y * edge1_x;
+  SimdFloat v = inv_det * (direction_x * s_cross_e1_x +
+                           direction_y * s_cross_e1_y +
+                           direction_z * s_cross_e1_z);
+  SimdFloat t = inv_det * (edge2_x * s_cross_e1_x + edge2_y * s_cross_e1_y +
+                           edge2_z * s_cross_e1_z);
+
+  SimdFloat zero(0.0f);
+  SimdFloat one(1.0f);
+  SimdFloat t_closest = SimdFloat::Load(packet.t_closest_);
+  SimdMask hit = (u >= zero) & (u <= one) & (v >= zero) & (u + v <= one) &
+                 (t > SimdFloat(1e-5f)) & (t < t_closest);
+  if (backface_culling) {
+    hit = hit & (det >= zero);
+  }
+
+  // Lanes outside of lane_mask did not reach the triangle, their hits are
+  // dropped
+  uint32_t hit_mask = simd_mask_bits(hit) & lane_mask;
+  if (hit_mask) {
+    float t_values[kRayPacketWidth];
+    float u_values[kRayPacketWidth];
+    float v_values[kRayPacketWidth];
+    t.Store(t_values);
+    u.Store(u_values);
+    v.Store(v_values);
+    for (uint32_t lanes = hit_mask; lanes; lanes &= lanes - 1) {
+      int lane = lowest_lane(lanes);
+      packet.t_closest_[lane] = t_values[lane];
+      lane_hits[lane] = {t_values[lane], u_values[lane], v_values[lane]};
+    }
+  }
+  return hit_mask;
+}
+
 class TriangleObject : public BaseObject {
  public:
   TriangleObject(std::shared_ptr<BaseMaterial> material, const Vec3f& v0,
@@ -13,14 +130,16 @@ class TriangleObject : public BaseObject {
         v1_(v1),
         v2_(v2) {};
 
-  std::shared_ptr<BoundingVolumeHierarchyElement> Intersect(
-      Ray& ray, float& t_hit, Vec3f& intersection_normal,
-      bool backface_culling = true,
-      bool stop_at_any_hit = false) const override;
+  bool Intersect(const Ray& ray, HitRecord& hit, bool backface_culling = true,
+                 bool stop_at_any_hit = false) const override;
+  bool Occluded(const Ray& ray, float t_max) const override;
+  void IntersectPacket(RayPacket& packet, uint32_t lane_mask, HitRecord* hits,
+                       bool backface_culling = true) const override;
 
   virtual ~TriangleObject() = default;
   void Preprocess(bool high_level_bvh_enabled, bool low_level_bvh_enabled,
-                  bool transform_enabled = true) override;
+                  bool transform_enabled = true,
+                  ThreadPool* thread_pool = nullptr) override;
 
  private:
   const Vec3f v0_;
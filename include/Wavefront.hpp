@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "BoundingVolumeHierarchy.hpp"
+#include "Random.hpp"
+#include "Ray.hpp"
+
+// Pixels [x_min, x_max) x [y_min, y_max) of an image, the unit of work the
+// schedulers hand out
+struct Tile {
+  int x_min, y_min;
+  int x_max, y_max;
+};
+
+// Samples traced together by the wavefront algorithm, tiles with more are
+// split into batches of whole pixels. The queues of a batch this size stay in
+// the L2 cache, larger batches spill and get slower.
+const int kWavefrontBatchSize = 2048;
+
+// A camera sample of the batch, the paths it spawns add their radiance into
+// value_. Its generator is drawn from by every vertex of its paths in turn.
+struct WavefrontSample {
+  Vec2i pixel_;
+  int ray_index_;
+  Vec2f diff_;
+  PCG32 random_;
+  Vec3f value_;
+};
+
+// State a ray of the wave carries instead of the stack frame of the recursive
+// algorithm. The radiance found at its hit is scaled by throughput_, the
+// product of the mirror, Fresnel and absorption factors along the path.
+// inside_object_ is the dielectric the ray travels through, owned by the scene.
+struct WavefrontPath {
+  uint32_t sample_;
+  int remaining_recursion_;
+  Vec3f throughput_;
+  const BoundingVolumeHierarchyElement* inside_object_;
+};
+
+// Shadow ray towards a light, radiance_ is added to its sample when the light
+// is not occluded
+struct WavefrontShadowRay {
+  Ray ray_;
+  float t_max_;
+  uint32_t sample_;
+  Vec3f radiance_;
+};
+
+// Queues between the stages of the wavefront algorithm. Every worker keeps
+// one for all the batches it traces, so their storage is allocated once.
+struct WavefrontQueues {
+  std::vector<WavefrontSample> samples_;
+
+  // Rays of the current wave, and the hits the closest hit stage found
+  std::vector<Ray> rays_;
+  std::vector<WavefrontPath> paths_;
+  std::vector<HitRecord> hits_;
+
+  // Order the shading stage visits the hits in, sorted by material type and
+  // ray direction
+  std::vector<uint8_t> keys_;
+  std::vector<uint32_t> order_;
+
+  // Secondary rays spawned by the shading stage, the next wave
+  std::vector<Ray> next_rays_;
+  std::vector<WavefrontPath> next_paths_;
+
+  std::vector<WavefrontShadowRay> shadow_rays_;
+};
\ No newline at end of file
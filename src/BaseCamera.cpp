@@ -17,7 +17,7 @@ BaseCamera::BaseCamera(
       mem_num_samples_(num_samples ? num_samples : 1),
       focus_distance_(focus_distance),
       aperture_size_(aperture_size),
-      aperture_type_(ApertureType::kDefault),
+      aperture_type_(aperture_type),
       l_(look_at_camera ? -near_distance * tan(fov_y * M_PI / 360.0f) *
                               float(image_width) / float(image_height)
                         : near_plane.x),
@@ -41,153 +41,107 @@ BaseCamera::BaseCamera(
   image_sampled_data_ =
       new Vec5f[image_height_ * image_width_ * mem_num_samples_];
   tonemapped_image_data_.resize(image_width_ * image_height_ * 3);
-  switch (time_sampling) {
-    case SamplingAlgorithm::kUniform:
-      time_sampling_algorithm_ = uniform_1d;
-      break;
-    case SamplingAlgorithm::kRandom:
-      time_sampling_algorithm_ = uniform_random_1d;
-      break;
-    case SamplingAlgorithm::kJittered:
-      time_sampling_algorithm_ = jittered_1d;
-      break;
-  }
 
-  switch (pixel_sampling) {
-    case SamplingAlgorithm::kUniform:
-      pixel_sampling_algorithm_ = uniform_2d;
+  switch (aperture_type_) {
+    case ApertureType::kPoly3:
+      aperture_edge_count_ = 3;
       break;
-    case SamplingAlgorithm::kRandom:
-      pixel_sampling_algorithm_ = uniform_random_2d;
+    case ApertureType::kPoly5:
+      aperture_edge_count_ = 5;
       break;
-    case SamplingAlgorithm::kJittered:
-      pixel_sampling_algorithm_ = jittered_2d;
+    case ApertureType::kPoly6:
+      aperture_edge_count_ = 6;
       break;
-    case SamplingAlgorithm::kMultiJittered:
-      pixel_sampling_algorithm_ = multi_jittered_2d;
-      break;
-    case SamplingAlgorithm::kHalton:
-      pixel_sampling_algorithm_ = halton_2d;
-      break;
-    case SamplingAlgorithm::kHammersley:
-      pixel_sampling_algorithm_ = hammersley_2d;
+    default:
+      aperture_edge_count_ = 0;
       break;
   }
 
-  switch (aperture_sampling) {
-    case SamplingAlgorithm::kUniform:
-      aperture_sampling_algorithm_ = uniform_2d;
-      break;
-    case SamplingAlgorithm::kRandom:
-      aperture_sampling_algorithm_ = uniform_random_2d;
-      break;
-    case SamplingAlgorithm::kJittered:
-      aperture_sampling_algorithm_ = jittered_2d;
-      break;
-    case SamplingAlgorithm::kMultiJittered:
-      aperture_sampling_algorithm_ = multi_jittered_2d;
-      break;
-    case SamplingAlgorithm::kHalton:
-      aperture_sampling_algorithm_ = halton_2d;
-      break;
-    case SamplingAlgorithm::kHammersley:
-      aperture_sampling_algorithm_ = hammersley_2d;
-      break;
-  }
-}
-
-std::vector<Ray> BaseCamera::GenerateRay(const Vec2i& pixel_coordinate) const {
   if (!num_samples_) {
-    float su = (pixel_coordinate.x + 0.5) * (r_ - l_) / image_width_;
-    float sv = (pixel_coordinate.y + 0.5) * (t_ - b_) / image_height_;
-    Vec3f d = normalize((q_ + (u_ * su)) - (v_ * sv) - position_);
-    return {Ray(pixel_coordinate, position_, d)};
+    return;
   }
 
-  std::vector<Ray> rays;
-
-  std::vector<float> time_samples = time_sampling_algorithm_(num_samples_);
+  time_sampler_ = Sampler(time_sampling, num_samples_, 1);
+  pixel_sampler_ = Sampler(pixel_sampling, num_samples_, 2);
 
   if (aperture_size_ > 0.0) {
+    // Polygonal apertures reject the samples outside of the polygon, enough
+    // samples are drawn to cover the area of the unit circle
     float aperture_sample_ratio = 1.0f;
 
-    if (aperture_type_ != ApertureType::kCircular &&
-        aperture_type_ != ApertureType::kSquare) {
+    if (aperture_edge_count_) {
       float area_of_unit_circle = M_PI;
-      int edge_count;
-
-      switch (aperture_type_) {
-        case ApertureType::kPoly3:
-          edge_count = 3;
-          break;
-        case ApertureType::kPoly5:
-          edge_count = 5;
-          break;
-        case ApertureType::kPoly6:
-          edge_count = 6;
-          break;
-      }
-
-      float center_angle_of_primitive_triangle = 2.0 * M_PI / (float)edge_count;
+      float center_angle_of_primitive_triangle =
+          2.0 * M_PI / (float)aperture_edge_count_;
       float area_of_primitive_triangle =
           0.5f * sin(center_angle_of_primitive_triangle);
-      float area_of_primitive_polygon = area_of_primitive_triangle * edge_count;
+      float area_of_primitive_polygon =
+          area_of_primitive_triangle * aperture_edge_count_;
       aperture_sample_ratio = area_of_unit_circle / area_of_primitive_polygon;
     }
 
-    std::vector<Vec2f> aperture_samples = aperture_sampling_algorithm_(
-        (int)(num_samples_ * aperture_sample_ratio));
-    std::vector<Vec2f> pixel_samples = pixel_sampling_algorithm_(num_samples_);
-
-    if (aperture_type_ != ApertureType::kCircular &&
-        aperture_type_ != ApertureType::kSquare) {
-      aperture_samples.erase(
-          std::remove_if(
-              aperture_samples.begin(), aperture_samples.end(),
-              [this](const Vec2f& sample) {
-                float radius = sqrt(sample.y);
-                float angle = 2.0f * M_PI * sample.x;
-
-                int edge_count;
-                switch (aperture_type_) {
-                  case ApertureType::kPoly3:
-                    edge_count = 3;
-                    break;
-                  case ApertureType::kPoly5:
-                    edge_count = 5;
-                    break;
-                  case ApertureType::kPoly6:
-                    edge_count = 6;
-                    break;
-                  default:
-                    return false;
-                }
-                float sector_angle = 2.0f * M_PI / edge_count;
-                float primitive_triangle_angle = fmod(angle, sector_angle);
-                float primitive_triangle_max_radius_for_angle =
-                    1.0f / cos(primitive_triangle_angle);
-                return radius > primitive_triangle_max_radius_for_angle;
-              }),
-          aperture_samples.end());
-    }
-    while (aperture_samples.size() < num_samples_) {
-      if (aperture_type_ == ApertureType::kSquare) {
-        aperture_samples.push_back(Vec2f{0.5f, 0.5f});
-      } else {
-        aperture_samples.push_back(Vec2f{0.0f, 0.0f});
-      }
-    }
+    aperture_sampler_ =
+        Sampler(aperture_sampling,
+                std::max((int)(num_samples_ * aperture_sample_ratio),
+                         (int)num_samples_),
+                2);
+  }
+}
 
-    for (int i = 0; i < num_samples_; i++) {
-      auto pixel_sample = pixel_samples[i];
-      auto aperture_sample = aperture_samples[i];
+bool BaseCamera::IsInsideAperture(const Vec2f& aperture_sample) const {
+  if (!aperture_edge_count_) {
+    return true;
+  }
+  float radius = sqrt(aperture_sample.y);
+  float angle = 2.0f * M_PI * aperture_sample.x;
+  float sector_angle = 2.0f * M_PI / aperture_edge_count_;
+  float primitive_triangle_angle = fmod(angle, sector_angle);
+  float primitive_triangle_max_radius_for_angle =
+      1.0f / cos(primitive_triangle_angle);
+  return radius <= primitive_triangle_max_radius_for_angle;
+}
+
+int BaseCamera::GenerateRays(const Vec2i& pixel_coordinate, Ray* rays) const {
+  if (!num_samples_) {
+    float su = (pixel_coordinate.x + 0.5) * (r_ - l_) / image_width_;
+    float sv = (pixel_coordinate.y + 0.5) * (t_ - b_) / image_height_;
+    Vec3f d = normalize((q_ + (u_ * su)) - (v_ * sv) - position_);
+    rays[0] = Ray(pixel_coordinate, position_, d);
+    return 1;
+  }
+
+  // Every sampler gets its own seed, so the pixel, time and aperture samples
+  // of a pixel are scrambled independently
+  uint64_t seed = pixel_seed(pixel_coordinate);
+  // The samplers take int sample indices
+  int sample_count = num_samples_;
+
+  if (aperture_size_ > 0.0) {
+    Vec3f forward = normalize(cross(v_, u_));
+    int aperture_sample_index = 0;
+
+    for (int i = 0; i < sample_count; i++) {
+      Vec2f pixel_sample = pixel_sampler_.Get2D(i, seed);
+      float time_sample = time_sampler_.Get1D(i, seed + 1);
+
+      Vec2f aperture_sample = aperture_type_ == ApertureType::kSquare
+                                  ? Vec2f{0.5f, 0.5f}
+                                  : Vec2f{0.0f, 0.0f};
+      while (aperture_sample_index < aperture_sampler_.sample_count_) {
+        Vec2f candidate =
+            aperture_sampler_.Get2D(aperture_sample_index++, seed + 2);
+        if (IsInsideAperture(candidate)) {
+          aperture_sample = candidate;
+          break;
+        }
+      }
 
       float su =
           (pixel_coordinate.x + pixel_sample.x) * (r_ - l_) / image_width_;
       float sv =
           (pixel_coordinate.y + pixel_sample.y) * (t_ - b_) / image_height_;
       Vec3f d = normalize((q_ + (u_ * su)) - (v_ * sv) - position_);
-      float t = focus_distance_ / dot(d, normalize(cross(v_, u_)));
+      float t = focus_distance_ / dot(d, forward);
       Vec3f focus_point = position_ + (d * t);
 
       Vec3f aperture_position;
@@ -204,24 +158,25 @@ std::vector<Ray> BaseCamera::GenerateRay(const Vec2i& pixel_coordinate) const {
         float y = s * sin(theta);
         aperture_position = position_ + (u_ * x) + (v_ * y);
       }
-      Ray ray(pixel_coordinate, aperture_position,
-              normalize(focus_point - aperture_position),
-              {pixel_sample.x, pixel_sample.y}, time_samples[i]);
-
-      rays.push_back(ray);
+      rays[i] = Ray(pixel_coordinate, aperture_position,
+                    normalize(focus_point - aperture_position),
+                    {pixel_sample.x, pixel_sample.y}, time_sample);
     }
   } else {
-    std::vector<Vec2f> samples = pixel_sampling_algorithm_(num_samples_);
-    for (int i = 0; i < samples.size(); i++) {
-      float su = (pixel_coordinate.x + samples[i].x) * (r_ - l_) / image_width_;
+    for (int i = 0; i < sample_count; i++) {
+      Vec2f pixel_sample = pixel_sampler_.Get2D(i, seed);
+      float time_sample = time_sampler_.Get1D(i, seed + 1);
+
+      float su =
+          (pixel_coordinate.x + pixel_sample.x) * (r_ - l_) / image_width_;
       float sv =
-          (pixel_coordinate.y + samples[i].y) * (t_ - b_) / image_height_;
+          (pixel_coordinate.y + pixel_sample.y) * (t_ - b_) / image_height_;
       Vec3f d = normalize((q_ + (u_ * su)) - (v_ * sv) - position_);
-      rays.push_back(Ray(pixel_coordinate, position_, d,
-                         {samples[i].x, samples[i].y}, time_samples[i]));
+      rays[i] = Ray(pixel_coordinate, position_, d,
+                    {pixel_sample.x, pixel_sample.y}, time_sample);
     }
   }
-  return rays;
+  return num_samples_;
 }
 
 void BaseCamera::UpdateSampledPixelValue(const Vec2i& pixel_coordinate,
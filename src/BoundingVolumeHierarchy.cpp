@@ -1,178 +1,1442 @@
 #include "BoundingVolumeHierarchy.hpp"
 
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <utility>
+
 #include "Helper.hpp"
+#include "ThreadPool.hpp"
 
-uint64_t BoundingVolumeHierarchyElement::id_counter_ = 0;
+std::atomic<uint64_t> BoundingVolumeHierarchyElement::id_counter_(0);
 bool BoundingVolumeHierarchyElement::trace_ = false;
 std::vector<Vec2i> BoundingVolumeHierarchyElement::trace_pixels_;
 
-std::shared_ptr<BoundingVolumeHierarchyElement>
-BoundingVolumeHierarchyElement::Intersect(Ray& ray, float& t_hit,
-                                          Vec3f& intersection_normal,
-                                          bool backface_culling,
-                                          bool stop_at_any_hit) const {
-  if (trace_ && std::find(trace_pixels_.begin(), trace_pixels_.end(),
-                          ray.pixel_) != trace_pixels_.end()) {
-    std::cout << "Checking node id: " << id_ << std::endl;
-    std::cout << "Min point: " << min_point_ << std::endl;
-    std::cout << "Max point: " << max_point_ << std::endl;
-    std::cout << "Ray pixel: " << ray.pixel_ << std::endl;
-    std::cout << "Ray origin: " << ray.origin_ << std::endl;
-    std::cout << "Ray direction: " << ray.direction_ << std::endl;
+struct BuildPrimitive {
+  Vec3f min_point_;
+  Vec3f max_point_;
+  Vec3f centroid_;
+  uint32_t index_;
+};
+
+// Number of centroid bins evaluated per axis by the SAH builder
+const int kSAHBinCount = 16;
+// Nodes with more primitives than this are always split by the SAH builder
+const int kMaxPrimitivesInLeaf = 4;
+// Cost of visiting a node relative to intersecting a single primitive
+const float kTraversalCost = 1.0f;
+// Primitives per chunk of the binning and partitioning of a parallel build
+const int kParallelBuildChunkSize = 1 << 14;
+
+static float SurfaceArea(const Vec3f& min_point, const Vec3f& max_point) {
+  Vec3f extent = max_point - min_point;
+  return 2.0f * (extent.x * extent.y + extent.y * extent.z +
+                 extent.z * extent.x);
+}
+
+// Bounds of a range of build primitives and of their centroids
+struct BuildBounds {
+  Vec3f min_point_;
+  Vec3f max_point_;
+  Vec3f centroid_min_;
+  Vec3f centroid_max_;
+};
+
+static BuildBounds ComputeBuildBounds(
+    const std::vector<BuildPrimitive>& build_primitives, int start, int end) {
+  BuildBounds bounds = {
+      build_primitives[start].min_point_, build_primitives[start].max_point_,
+      build_primitives[start].centroid_, build_primitives[start].centroid_};
+  for (int i = start + 1; i < end; i++) {
+    bounds.min_point_ =
+        component_min(bounds.min_point_, build_primitives[i].min_point_);
+    bounds.max_point_ =
+        component_max(bounds.max_point_, build_primitives[i].max_point_);
+    bounds.centroid_min_ =
+        component_min(bounds.centroid_min_, build_primitives[i].centroid_);
+    bounds.centroid_max_ =
+        component_max(bounds.centroid_max_, build_primitives[i].centroid_);
   }
-  // Calculate the intersection of the ray with the bounding box
-  float t_min = (min_point_.x - ray.origin_.x) / ray.direction_.x;
-  float t_max = (max_point_.x - ray.origin_.x) / ray.direction_.x;
+  return bounds;
+}
+
+static void MergeBuildBounds(BuildBounds& bounds, const BuildBounds& other) {
+  bounds.min_point_ = component_min(bounds.min_point_, other.min_point_);
+  bounds.max_point_ = component_max(bounds.max_point_, other.max_point_);
+  bounds.centroid_min_ =
+      component_min(bounds.centroid_min_, other.centroid_min_);
+  bounds.centroid_max_ =
+      component_max(bounds.centroid_max_, other.centroid_max_);
+}
+
+// Appends a node with the given bounds and returns its offset
+static uint32_t AddNode(const BuildBounds& bounds,
+                        std::vector<LinearBVHNode>& nodes) {
+  uint32_t node_offset = nodes.size();
+  nodes.push_back(LinearBVHNode());
+  nodes[node_offset].min_point_ = bounds.min_point_;
+  nodes[node_offset].max_point_ = bounds.max_point_;
+  nodes[node_offset].primitive_count_ = 0;
+  nodes[node_offset].axis_ = 0;
+  nodes[node_offset].padding_ = 0;
+
+  return node_offset;
+}
+
+static void InitializeLeaf(LinearBVHNode& node, int start, int end) {
+  node.primitives_offset_ = start;
+  node.primitive_count_ = end - start;
+}
+
+static void SortByCentroid(std::vector<BuildPrimitive>& build_primitives,
+                           int start, int end, int axis) {
+  std::sort(build_primitives.begin() + start, build_primitives.begin() + end,
+            [axis](const BuildPrimitive& a, const BuildPrimitive& b) {
+              return component(a.centroid_, axis) <
+                     component(b.centroid_, axis);
+            });
+}
 
-  if (t_min > t_max) {
-    std::swap(t_min, t_max);
+// Emits the subtree of build_primitives[start, end) into nodes in depth-first
+// order and returns the offset of its root node. Ranges that fit in a single
+// block of leaf_block_width primitives become leaves.
+static uint32_t BuildMedianSplit(std::vector<BuildPrimitive>& build_primitives,
+                                 int start, int end, int axis,
+                                 int leaf_block_width,
+                                 std::vector<LinearBVHNode>& nodes) {
+  uint32_t node_offset =
+      AddNode(ComputeBuildBounds(build_primitives, start, end), nodes);
+  nodes[node_offset].axis_ = axis;
+
+  if (end - start <= leaf_block_width) {
+    InitializeLeaf(nodes[node_offset], start, end);
+    return node_offset;
   }
 
-  float t_y_min = (min_point_.y - ray.origin_.y) / ray.direction_.y;
-  float t_y_max = (max_point_.y - ray.origin_.y) / ray.direction_.y;
+  SortByCentroid(build_primitives, start, end, axis);
+
+  int mid = start + (end - start) / 2;
+  BuildMedianSplit(build_primitives, start, mid, (axis + 1) % 3,
+                   leaf_block_width, nodes);
+  uint32_t second_child_offset = BuildMedianSplit(
+      build_primitives, mid, end, (axis + 1) % 3, leaf_block_width, nodes);
+  nodes[node_offset].second_child_offset_ = second_child_offset;
+
+  return node_offset;
+}
+
+struct SAHBin {
+  int count_;
+  Vec3f min_point_;
+  Vec3f max_point_;
+};
 
-  if (t_y_min > t_y_max) {
-    std::swap(t_y_min, t_y_max);
+// Centroid bins of all three axes, the axes without centroid extent stay
+// empty
+struct SAHBins {
+  SAHBin bins_[3][kSAHBinCount];
+};
+
+static int SAHBinIndex(const BuildPrimitive& build_primitive, int axis,
+                       float centroid_min, float centroid_extent) {
+  int bin = kSAHBinCount *
+            (component(build_primitive.centroid_, axis) - centroid_min) /
+            centroid_extent;
+  return std::min(bin, kSAHBinCount - 1);
+}
+
+static void InitializeSAHBins(SAHBins& bins) {
+  for (int axis = 0; axis < 3; axis++) {
+    for (int b = 0; b < kSAHBinCount; b++) {
+      SAHBin& bin = bins.bins_[axis][b];
+      bin.count_ = 0;
+      bin.min_point_ = {std::numeric_limits<float>::max(),
+                        std::numeric_limits<float>::max(),
+                        std::numeric_limits<float>::max()};
+      bin.max_point_ = -bin.min_point_;
+    }
   }
+}
 
-  if ((t_min > t_y_max) || (t_y_min > t_max)) {
-    return nullptr;
+static void FillSAHBins(const std::vector<BuildPrimitive>& build_primitives,
+                        int start, int end, const BuildBounds& bounds,
+                        SAHBins& bins) {
+  Vec3f centroid_extent = bounds.centroid_max_ - bounds.centroid_min_;
+  for (int i = start; i < end; i++) {
+    for (int axis = 0; axis < 3; axis++) {
+      float axis_centroid_extent = component(centroid_extent, axis);
+      if (axis_centroid_extent <= 0.0f) {
+        continue;
+      }
+      SAHBin& bin = bins.bins_[axis][SAHBinIndex(
+          build_primitives[i], axis, component(bounds.centroid_min_, axis),
+          axis_centroid_extent)];
+      bin.count_++;
+      bin.min_point_ =
+          component_min(bin.min_point_, build_primitives[i].min_point_);
+      bin.max_point_ =
+          component_max(bin.max_point_, build_primitives[i].max_point_);
+    }
   }
+}
 
-  if (t_y_min > t_min) {
-    t_min = t_y_min;
+static void MergeSAHBins(SAHBins& bins, const SAHBins& other) {
+  for (int axis = 0; axis < 3; axis++) {
+    for (int b = 0; b < kSAHBinCount; b++) {
+      SAHBin& bin = bins.bins_[axis][b];
+      const SAHBin& other_bin = other.bins_[axis][b];
+      bin.count_ += other_bin.count_;
+      bin.min_point_ = component_min(bin.min_point_, other_bin.min_point_);
+      bin.max_point_ = component_max(bin.max_point_, other_bin.max_point_);
+    }
   }
+}
+
+// Split chosen by the SAH builder. Leaves have axis_ -1, a bin_ of -1 splits
+// in half at the median centroid on axis_ instead of at a bin boundary.
+struct SAHSplit {
+  int axis_;
+  int bin_;
+};
+
+// Picks the centroid bin boundary with the lowest surface area heuristic cost
+// over all three axes, or a leaf when splitting is not worth it. A leaf costs
+// one primitive test per started block of leaf_block_width primitives.
+static SAHSplit ChooseSAHSplit(const SAHBins& bins, const BuildBounds& bounds,
+                               int primitive_count, int depth,
+                               int leaf_block_width) {
+  // Costs are kept multiplied by the node area to stay finite for flat nodes
+  float node_area = SurfaceArea(bounds.min_point_, bounds.max_point_);
+  float best_cost = std::numeric_limits<float>::max();
+  int best_axis = -1;
+  int best_bin = -1;
+
+  for (int axis = 0; axis < 3; axis++) {
+    if (component(bounds.centroid_max_, axis) -
+            component(bounds.centroid_min_, axis) <=
+        0.0f) {
+      continue;
+    }
+    const SAHBin* axis_bins = bins.bins_[axis];
+
+    // Sweep from the right to get the cost of everything after each boundary
+    float right_cost[kSAHBinCount];
+    int right_count = 0;
+    Vec3f right_min = axis_bins[kSAHBinCount - 1].min_point_;
+    Vec3f right_max = axis_bins[kSAHBinCount - 1].max_point_;
+    for (int b = kSAHBinCount - 1; b > 0; b--) {
+      right_count += axis_bins[b].count_;
+      right_min = component_min(right_min, axis_bins[b].min_point_);
+      right_max = component_max(right_max, axis_bins[b].max_point_);
+      right_cost[b] =
+          right_count ? right_count * SurfaceArea(right_min, right_max) : 0.0f;
+    }
 
-  if (t_y_max < t_max) {
-    t_max = t_y_max;
+    int left_count = 0;
+    Vec3f left_min = axis_bins[0].min_point_;
+    Vec3f left_max = axis_bins[0].max_point_;
+    for (int b = 0; b < kSAHBinCount - 1; b++) {
+      left_count += axis_bins[b].count_;
+      left_min = component_min(left_min, axis_bins[b].min_point_);
+      left_max = component_max(left_max, axis_bins[b].max_point_);
+      if (left_count == 0 || left_count == primitive_count) {
+        continue;
+      }
+      float cost = kTraversalCost * node_area +
+                   left_count * SurfaceArea(left_min, left_max) +
+                   right_cost[b + 1];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_bin = b;
+      }
+    }
   }
 
-  float t_z_min = (min_point_.z - ray.origin_.z) / ray.direction_.z;
-  float t_z_max = (max_point_.z - ray.origin_.z) / ray.direction_.z;
+  int leaf_block_count =
+      (primitive_count + leaf_block_width - 1) / leaf_block_width;
+  float leaf_cost = leaf_block_count * node_area;
+  if (primitive_count <= std::max(kMaxPrimitivesInLeaf, leaf_block_width) &&
+      (best_axis == -1 || leaf_cost <= best_cost)) {
+    return {-1, -1};
+  }
 
-  if (t_z_min > t_z_max) {
-    std::swap(t_z_min, t_z_max);
+  if (best_axis == -1 || depth >= kMaxBVHDepth - 32) {
+    // No usable centroid split or the tree is getting too deep, split in half
+    // on the widest axis so the remaining depth stays logarithmic
+    Vec3f centroid_extent = bounds.centroid_max_ - bounds.centroid_min_;
+    int axis = centroid_extent.x > centroid_extent.y
+                   ? (centroid_extent.x > centroid_extent.z ? 0 : 2)
+                   : (centroid_extent.y > centroid_extent.z ? 1 : 2);
+    return {axis, -1};
   }
+  return {best_axis, best_bin};
+}
+
+static int SplitAtMedian(std::vector<BuildPrimitive>& build_primitives,
+                         int start, int end, int axis) {
+  int mid = start + (end - start) / 2;
+  std::nth_element(build_primitives.begin() + start,
+                   build_primitives.begin() + mid,
+                   build_primitives.begin() + end,
+                   [axis](const BuildPrimitive& a, const BuildPrimitive& b) {
+                     return component(a.centroid_, axis) <
+                            component(b.centroid_, axis);
+                   });
+  return mid;
+}
+
+// Same as BuildMedianSplit, but splits every node where ChooseSAHSplit says
+// and stops at multi primitive leaves when splitting is not worth it
+static uint32_t BuildSAHSplit(std::vector<BuildPrimitive>& build_primitives,
+                              int start, int end, int depth,
+                              int leaf_block_width,
+                              std::vector<LinearBVHNode>& nodes) {
+  BuildBounds bounds = ComputeBuildBounds(build_primitives, start, end);
+  uint32_t node_offset = AddNode(bounds, nodes);
 
-  if ((t_min > t_z_max) || (t_z_min > t_max)) {
-    return nullptr;
+  if (end - start == 1) {
+    InitializeLeaf(nodes[node_offset], start, end);
+    return node_offset;
   }
 
-  if (t_z_min > t_min) {
-    t_min = t_z_min;
+  SAHBins bins;
+  InitializeSAHBins(bins);
+  FillSAHBins(build_primitives, start, end, bounds, bins);
+  SAHSplit split =
+      ChooseSAHSplit(bins, bounds, end - start, depth, leaf_block_width);
+  if (split.axis_ < 0) {
+    InitializeLeaf(nodes[node_offset], start, end);
+    return node_offset;
   }
 
-  if (t_z_max < t_max) {
-    t_max = t_z_max;
+  int mid;
+  if (split.bin_ < 0) {
+    mid = SplitAtMedian(build_primitives, start, end, split.axis_);
+  } else {
+    int axis = split.axis_;
+    float axis_centroid_min = component(bounds.centroid_min_, axis);
+    float axis_centroid_extent =
+        component(bounds.centroid_max_, axis) - axis_centroid_min;
+    int bin = split.bin_;
+    mid = std::partition(build_primitives.begin() + start,
+                         build_primitives.begin() + end,
+                         [=](const BuildPrimitive& build_primitive) {
+                           return SAHBinIndex(build_primitive, axis,
+                                              axis_centroid_min,
+                                              axis_centroid_extent) <= bin;
+                         }) -
+          build_primitives.begin();
   }
+  nodes[node_offset].axis_ = split.axis_;
+
+  BuildSAHSplit(build_primitives, start, mid, depth + 1, leaf_block_width,
+                nodes);
+  uint32_t second_child_offset = BuildSAHSplit(
+      build_primitives, mid, end, depth + 1, leaf_block_width, nodes);
+  nodes[node_offset].second_child_offset_ = second_child_offset;
+
+  return node_offset;
+}
+
+// Range of primitives below the top levels of a parallel build, built into
+// nodes_ of its own by a single task
+struct BuildSubtree {
+  int start_;
+  int end_;
+  int depth_;
+  int axis_;
+  std::vector<LinearBVHNode> nodes_;
+};
+
+// A parallel build splits the ranges of at least kParallelBuildMinPrimitives
+// primitives on the calling thread into top_nodes_, with the bounds, the bins
+// and the partition of every range computed in chunks on the thread pool. The
+// smaller ranges below them become subtrees built by one task each, whose top
+// node only stands in for them until all the nodes are spliced together.
+struct ParallelBuild {
+  ParallelBuild(std::vector<BuildPrimitive>& build_primitives,
+                BVHConstructionAlgorithm construction_algorithm,
+                int leaf_block_width, ThreadPool& thread_pool)
+      : build_primitives_(build_primitives),
+        construction_algorithm_(construction_algorithm),
+        leaf_block_width_(leaf_block_width),
+        thread_pool_(thread_pool) {}
 
-  // Check if the intersection is within the valid range
-  if (t_max < 0) {
-    return nullptr;
+  std::vector<BuildPrimitive>& build_primitives_;
+  const BVHConstructionAlgorithm construction_algorithm_;
+  const int leaf_block_width_;
+  ThreadPool& thread_pool_;
+  // Partitions go through it, as large as build_primitives_
+  std::vector<BuildPrimitive> scratch_;
+  std::vector<LinearBVHNode> top_nodes_;
+  // Subtree of every top node, -1 for the top nodes that were split
+  std::vector<int> top_node_subtrees_;
+  std::vector<BuildSubtree> subtrees_;
+};
+
+// Runs body(chunk_start, chunk_end) for the chunks of kParallelBuildChunkSize
+// primitives of [start, end) on the thread pool, returns the chunk count
+template <typename Body>
+static int ForEachBuildChunk(ThreadPool& thread_pool, int start, int end,
+                             Body body) {
+  int chunk_count =
+      (end - start + kParallelBuildChunkSize - 1) / kParallelBuildChunkSize;
+  thread_pool.ParallelFor(0, chunk_count, 1, [&](int chunk) {
+    int chunk_start = start + chunk * kParallelBuildChunkSize;
+    body(chunk, chunk_start,
+         std::min(chunk_start + kParallelBuildChunkSize, end));
+  });
+  return chunk_count;
+}
+
+static BuildBounds ComputeBuildBoundsParallel(ParallelBuild& build, int start,
+                                              int end) {
+  std::vector<BuildBounds> chunk_bounds(
+      (end - start + kParallelBuildChunkSize - 1) / kParallelBuildChunkSize);
+  ForEachBuildChunk(build.thread_pool_, start, end,
+                    [&](int chunk, int chunk_start, int chunk_end) {
+                      chunk_bounds[chunk] = ComputeBuildBounds(
+                          build.build_primitives_, chunk_start, chunk_end);
+                    });
+  for (size_t chunk = 1; chunk < chunk_bounds.size(); chunk++) {
+    MergeBuildBounds(chunk_bounds[0], chunk_bounds[chunk]);
   }
+  return chunk_bounds[0];
+}
 
-  if (trace_ && std::find(trace_pixels_.begin(), trace_pixels_.end(),
-                          ray.pixel_) != trace_pixels_.end()) {
-    std::cout << "Intersects with node id: " << id_ << std::endl;
+static void FillSAHBinsParallel(ParallelBuild& build, int start, int end,
+                                const BuildBounds& bounds, SAHBins& bins) {
+  std::vector<SAHBins> chunk_bins(
+      (end - start + kParallelBuildChunkSize - 1) / kParallelBuildChunkSize);
+  ForEachBuildChunk(build.thread_pool_, start, end,
+                    [&](int chunk, int chunk_start, int chunk_end) {
+                      InitializeSAHBins(chunk_bins[chunk]);
+                      FillSAHBins(build.build_primitives_, chunk_start,
+                                  chunk_end, bounds, chunk_bins[chunk]);
+                    });
+  InitializeSAHBins(bins);
+  for (const SAHBins& chunk_bin : chunk_bins) {
+    MergeSAHBins(bins, chunk_bin);
   }
+}
+
+// Moves the primitives of [start, end) for which goes_left holds in front of
+// the others, keeping their order, and returns the first of the others. Every
+// chunk counts its left primitives first, so it knows where to scatter them.
+template <typename Predicate>
+static int PartitionParallel(ParallelBuild& build, int start, int end,
+                             Predicate goes_left) {
+  std::vector<BuildPrimitive>& build_primitives = build.build_primitives_;
+  std::vector<int> chunk_left_counts(
+      (end - start + kParallelBuildChunkSize - 1) / kParallelBuildChunkSize);
+  ForEachBuildChunk(build.thread_pool_, start, end,
+                    [&](int chunk, int chunk_start, int chunk_end) {
+                      int left_count = 0;
+                      for (int i = chunk_start; i < chunk_end; i++) {
+                        left_count += goes_left(build_primitives[i]);
+                      }
+                      chunk_left_counts[chunk] = left_count;
+                    });
 
-  float left_t_hit, right_t_hit;
-  Vec3f left_intersection_normal, right_intersection_normal;
-  std::shared_ptr<BoundingVolumeHierarchyElement> left_intersection = nullptr,
-                                                  right_intersection = nullptr;
-  if (left_) {
-    left_intersection =
-        left_->Intersect(ray, left_t_hit, left_intersection_normal,
-                         backface_culling, stop_at_any_hit);
+  int mid = start;
+  for (int left_count : chunk_left_counts) {
+    mid += left_count;
   }
-  if (right_) {
-    right_intersection =
-        right_->Intersect(ray, right_t_hit, right_intersection_normal,
-                          backface_culling, stop_at_any_hit);
+  std::vector<int> chunk_left_offsets(chunk_left_counts.size());
+  std::vector<int> chunk_right_offsets(chunk_left_counts.size());
+  int left_offset = start;
+  int right_offset = mid;
+  for (size_t chunk = 0; chunk < chunk_left_counts.size(); chunk++) {
+    int chunk_size =
+        std::min(kParallelBuildChunkSize,
+                 end - start - int(chunk) * kParallelBuildChunkSize);
+    chunk_left_offsets[chunk] = left_offset;
+    chunk_right_offsets[chunk] = right_offset;
+    left_offset += chunk_left_counts[chunk];
+    right_offset += chunk_size - chunk_left_counts[chunk];
   }
 
-  if (left_intersection && right_intersection) {
-    if (left_t_hit < right_t_hit) {
-      t_hit = left_t_hit;
-      intersection_normal = left_intersection_normal;
-      return left_intersection;
-    } else {
-      t_hit = right_t_hit;
-      intersection_normal = right_intersection_normal;
-      return right_intersection;
-    }
-  } else if (left_intersection) {
-    t_hit = left_t_hit;
-    intersection_normal = left_intersection_normal;
-    return left_intersection;
-  } else if (right_intersection) {
-    t_hit = right_t_hit;
-    intersection_normal = right_intersection_normal;
-    return right_intersection;
+  ForEachBuildChunk(
+      build.thread_pool_, start, end,
+      [&](int chunk, int chunk_start, int chunk_end) {
+        int left = chunk_left_offsets[chunk];
+        int right = chunk_right_offsets[chunk];
+        for (int i = chunk_start; i < chunk_end; i++) {
+          build.scratch_[goes_left(build_primitives[i]) ? left++ : right++] =
+              build_primitives[i];
+        }
+      });
+  ForEachBuildChunk(build.thread_pool_, start, end,
+                    [&](int, int chunk_start, int chunk_end) {
+                      std::copy(build.scratch_.begin() + chunk_start,
+                                build.scratch_.begin() + chunk_end,
+                                build_primitives.begin() + chunk_start);
+                    });
+  return mid;
+}
+
+// Bins of the centroid histogram that finds the median of a parallel median
+// split
+const int kMedianBinCount = 1024;
+
+// SplitAtMedian for the top levels of a parallel build. A centroid histogram
+// filled in chunks finds the bin holding the median. Two parallel partitions
+// move the primitives of the bins below it to the front and those of the
+// median bin right behind them, so only that bin is left to the serial
+// selection.
+static int SplitAtMedianParallel(ParallelBuild& build, int start, int end,
+                                 int axis, const BuildBounds& bounds) {
+  int mid = start + (end - start) / 2;
+  float axis_centroid_min = component(bounds.centroid_min_, axis);
+  float axis_centroid_extent =
+      component(bounds.centroid_max_, axis) - axis_centroid_min;
+  if (axis_centroid_extent <= 0.0f) {
+    // All centroids are equal along the axis, every split is at the median
+    return mid;
+  }
+  auto median_bin = [=](const BuildPrimitive& build_primitive) {
+    int bin = kMedianBinCount *
+              (component(build_primitive.centroid_, axis) - axis_centroid_min) /
+              axis_centroid_extent;
+    return std::min(bin, kMedianBinCount - 1);
+  };
+
+  std::vector<int> chunk_bin_counts(
+      (end - start + kParallelBuildChunkSize - 1) / kParallelBuildChunkSize *
+          kMedianBinCount,
+      0);
+  ForEachBuildChunk(build.thread_pool_, start, end,
+                    [&](int chunk, int chunk_start, int chunk_end) {
+                      int* bin_counts =
+                          chunk_bin_counts.data() + chunk * kMedianBinCount;
+                      for (int i = chunk_start; i < chunk_end; i++) {
+                        bin_counts[median_bin(build.build_primitives_[i])]++;
+                      }
+                    });
+  int bin_counts[kMedianBinCount] = {};
+  for (size_t i = 0; i < chunk_bin_counts.size(); i++) {
+    bin_counts[i % kMedianBinCount] += chunk_bin_counts[i];
+  }
+  int median = 0;
+  int median_bin_end = start + bin_counts[0];
+  while (median_bin_end <= mid) {
+    median_bin_end += bin_counts[++median];
+  }
+
+  int median_start = PartitionParallel(
+      build, start, end, [=](const BuildPrimitive& build_primitive) {
+        return median_bin(build_primitive) < median;
+      });
+  int median_end = PartitionParallel(
+      build, median_start, end, [=](const BuildPrimitive& build_primitive) {
+        return median_bin(build_primitive) == median;
+      });
+  std::nth_element(build.build_primitives_.begin() + median_start,
+                   build.build_primitives_.begin() + mid,
+                   build.build_primitives_.begin() + median_end,
+                   [axis](const BuildPrimitive& a, const BuildPrimitive& b) {
+                     return component(a.centroid_, axis) <
+                            component(b.centroid_, axis);
+                   });
+  return mid;
+}
+
+// BuildMedianSplit or BuildSAHSplit for the top levels of a parallel build,
+// returns the offset of the top node of [start, end)
+static uint32_t BuildTopLevels(ParallelBuild& build, int start, int end,
+                               int depth, int axis) {
+  if (end - start < kParallelBuildMinPrimitives) {
+    uint32_t node_offset = build.top_nodes_.size();
+    build.top_nodes_.push_back(LinearBVHNode());
+    build.top_node_subtrees_.push_back(build.subtrees_.size());
+    build.subtrees_.push_back(BuildSubtree());
+    BuildSubtree& subtree = build.subtrees_.back();
+    subtree.start_ = start;
+    subtree.end_ = end;
+    subtree.depth_ = depth;
+    subtree.axis_ = axis;
+    return node_offset;
+  }
+
+  BuildBounds bounds = ComputeBuildBoundsParallel(build, start, end);
+  uint32_t node_offset = AddNode(bounds, build.top_nodes_);
+  build.top_node_subtrees_.push_back(-1);
+
+  // Ranges this large are never leaves
+  int mid;
+  if (build.construction_algorithm_ == BVHConstructionAlgorithm::kMedian) {
+    mid = SplitAtMedianParallel(build, start, end, axis, bounds);
   } else {
-    return nullptr;
+    SAHBins bins;
+    FillSAHBinsParallel(build, start, end, bounds, bins);
+    SAHSplit split = ChooseSAHSplit(bins, bounds, end - start, depth,
+                                    build.leaf_block_width_);
+    axis = split.axis_;
+    if (split.bin_ < 0) {
+      mid = SplitAtMedian(build.build_primitives_, start, end, axis);
+    } else {
+      float axis_centroid_min = component(bounds.centroid_min_, axis);
+      float axis_centroid_extent =
+          component(bounds.centroid_max_, axis) - axis_centroid_min;
+      int bin = split.bin_;
+      mid = PartitionParallel(
+          build, start, end, [=](const BuildPrimitive& build_primitive) {
+            return SAHBinIndex(build_primitive, axis, axis_centroid_min,
+                               axis_centroid_extent) <= bin;
+          });
+    }
   }
+  build.top_nodes_[node_offset].axis_ = axis;
+
+  BuildTopLevels(build, start, mid, depth + 1, (axis + 1) % 3);
+  uint32_t second_child_offset =
+      BuildTopLevels(build, mid, end, depth + 1, (axis + 1) % 3);
+  build.top_nodes_[node_offset].second_child_offset_ = second_child_offset;
+
+  return node_offset;
 }
 
-std::shared_ptr<BoundingVolumeHierarchyElement>
-BoundingVolumeHierarchyElement::Construct(
-    std::vector<std::shared_ptr<BoundingVolumeHierarchyElement>>& leafs,
-    int start, int end, int axis) {
-  if (end - start == 0) {
-    return nullptr;
+// Appends the top node at top_node_offset and everything below it to nodes in
+// depth-first order, the subtrees in place of their top nodes. Returns the
+// offset the top node got.
+static uint32_t SpliceNodes(const ParallelBuild& build,
+                            uint32_t top_node_offset,
+                            std::vector<LinearBVHNode>& nodes) {
+  uint32_t node_offset = nodes.size();
+  int subtree = build.top_node_subtrees_[top_node_offset];
+  if (subtree >= 0) {
+    for (LinearBVHNode node : build.subtrees_[subtree].nodes_) {
+      if (node.primitive_count_ == 0) {
+        node.second_child_offset_ += node_offset;
+      }
+      nodes.push_back(node);
+    }
+    return node_offset;
   }
-  if (end - start == 1) {
-    return leafs[start];
+
+  nodes.push_back(build.top_nodes_[top_node_offset]);
+  SpliceNodes(build, top_node_offset + 1, nodes);
+  uint32_t second_child_offset = SpliceNodes(
+      build, build.top_nodes_[top_node_offset].second_child_offset_, nodes);
+  nodes[node_offset].second_child_offset_ = second_child_offset;
+
+  return node_offset;
+}
+
+static void BuildParallel(std::vector<BuildPrimitive>& build_primitives,
+                          const BVHConstructionAlgorithm construction_algorithm,
+                          int leaf_block_width, ThreadPool& thread_pool,
+                          std::vector<LinearBVHNode>& nodes) {
+  ParallelBuild build(build_primitives, construction_algorithm,
+                      leaf_block_width, thread_pool);
+  build.scratch_.resize(build_primitives.size());
+  BuildTopLevels(build, 0, build_primitives.size(), 0, 0);
+  std::vector<BuildPrimitive>().swap(build.scratch_);
+
+  // The subtrees cover disjoint ranges of the primitives
+  thread_pool.ParallelFor(0, build.subtrees_.size(), 1, [&](int subtree) {
+    BuildSubtree& build_subtree = build.subtrees_[subtree];
+    build_subtree.nodes_.reserve(
+        2 * (build_subtree.end_ - build_subtree.start_) - 1);
+    switch (construction_algorithm) {
+      case BVHConstructionAlgorithm::kMedian:
+        BuildMedianSplit(build_primitives, build_subtree.start_,
+                         build_subtree.end_, build_subtree.axis_,
+                         leaf_block_width, build_subtree.nodes_);
+        break;
+      case BVHConstructionAlgorithm::kSAH:
+        BuildSAHSplit(build_primitives, build_subtree.start_,
+                      build_subtree.end_, build_subtree.depth_,
+                      leaf_block_width, build_subtree.nodes_);
+        break;
+      case BVHConstructionAlgorithm::kLBVH:
+      case BVHConstructionAlgorithm::kTreeletLBVH:
+        // Build() never builds an LBVH in parallel
+        assert(false);
+        break;
+    }
+  });
+
+  SpliceNodes(build, 0, nodes);
+}
+
+// Morton code of a primitive centroid and the index of the primitive, sorted
+// together
+struct MortonPrimitive {
+  uint64_t code_;
+  uint32_t index_;
+};
+
+// Spreads the low 21 bits of value out to every third bit
+static uint64_t SpreadMortonBits(uint32_t value) {
+  uint64_t bits = value & 0x1fffff;
+  bits = (bits | bits << 32) & 0x1f00000000ffffull;
+  bits = (bits | bits << 16) & 0x1f0000ff0000ffull;
+  bits = (bits | bits << 8) & 0x100f00f00f00f00full;
+  bits = (bits | bits << 4) & 0x10c30c30c30c30c3ull;
+  bits = (bits | bits << 2) & 0x1249249249249249ull;
+  return bits;
+}
+
+// Sorts by the low bit_count bits of the codes, eight bits per pass
+static void RadixSortMortonPrimitives(
+    std::vector<MortonPrimitive>& morton_primitives, int bit_count) {
+  std::vector<MortonPrimitive> sorted(morton_primitives.size());
+  for (int shift = 0; shift < bit_count; shift += 8) {
+    size_t bucket_offsets[257] = {};
+    for (const MortonPrimitive& morton_primitive : morton_primitives) {
+      bucket_offsets[((morton_primitive.code_ >> shift) & 0xff) + 1]++;
+    }
+    for (int bucket = 1; bucket < 257; bucket++) {
+      bucket_offsets[bucket] += bucket_offsets[bucket - 1];
+    }
+    for (const MortonPrimitive& morton_primitive : morton_primitives) {
+      sorted[bucket_offsets[(morton_primitive.code_ >> shift) & 0xff]++] =
+          morton_primitive;
+    }
+    morton_primitives.swap(sorted);
   }
+}
 
-  std::sort(leafs.begin() + start, leafs.begin() + end,
-            [axis](const std::shared_ptr<BoundingVolumeHierarchyElement>& a,
-                   const std::shared_ptr<BoundingVolumeHierarchyElement>& b) {
-              return ((a->max_point_ + a->min_point_)[axis]) <
-                     ((b->max_point_ + b->min_point_)[axis]);
-            });
+// Node of an LBVH before it is flattened. The treelet restructuring moves
+// whole subtrees around, so the children are linked instead of following
+// the depth-first order.
+struct LBVHNode {
+  Vec3f min_point_;
+  Vec3f max_point_;
+  int children_[2];  // -1 for leaves
+  int start_;        // Primitive range of leaves
+  int end_;
+  // Surface area heuristic cost of the subtree, multiplied by the node area
+  // like the costs of the SAH builder
+  float cost_;
+};
 
-  int mid = start + (end - start) / 2;
-  std::shared_ptr<BoundingVolumeHierarchyElement> left =
-      Construct(leafs, start, mid, (axis + 1) % 3);
-  std::shared_ptr<BoundingVolumeHierarchyElement> right =
-      Construct(leafs, mid, end, (axis + 1) % 3);
-
-  std::shared_ptr<BoundingVolumeHierarchyElement> node =
-      std::make_shared<BoundingVolumeHierarchyElement>();
-  node->InitializeChildren(left, right);
-  if (left && right) {
-    node->min_point_ = {std::min(left->min_point_.x, right->min_point_.x),
-                        std::min(left->min_point_.y, right->min_point_.y),
-                        std::min(left->min_point_.z, right->min_point_.z)};
-    node->max_point_ = {std::max(left->max_point_.x, right->max_point_.x),
-                        std::max(left->max_point_.y, right->max_point_.y),
-                        std::max(left->max_point_.z, right->max_point_.z)};
-  } else if (left) {
-    node->min_point_ = left->min_point_;
-    node->max_point_ = left->max_point_;
-  } else if (right) {
-    node->min_point_ = right->min_point_;
-    node->max_point_ = right->max_point_;
+static float LBVHLeafCost(const LBVHNode& node, int leaf_block_width) {
+  int leaf_block_count =
+      (node.end_ - node.start_ + leaf_block_width - 1) / leaf_block_width;
+  return leaf_block_count * SurfaceArea(node.min_point_, node.max_point_);
+}
+
+// Splits build_primitives[start, end), sorted by Morton code, where the
+// highest bit that differs within the range flips, which is the octree cell
+// boundary of the codes. Every node takes a binary search, there is no
+// binning or sorting per node. Returns the index of the node.
+static int BuildLBVHNode(
+    const std::vector<MortonPrimitive>& morton_primitives,
+    const std::vector<BuildPrimitive>& build_primitives, int start, int end,
+    int depth, int leaf_block_width, std::vector<LBVHNode>& lbvh_nodes) {
+  int node = lbvh_nodes.size();
+  lbvh_nodes.push_back(LBVHNode());
+  lbvh_nodes[node].start_ = start;
+  lbvh_nodes[node].end_ = end;
+
+  if (end - start <= leaf_block_width) {
+    BuildBounds bounds = ComputeBuildBounds(build_primitives, start, end);
+    lbvh_nodes[node].min_point_ = bounds.min_point_;
+    lbvh_nodes[node].max_point_ = bounds.max_point_;
+    lbvh_nodes[node].children_[0] = -1;
+    lbvh_nodes[node].children_[1] = -1;
+    lbvh_nodes[node].cost_ = LBVHLeafCost(lbvh_nodes[node], leaf_block_width);
+    return node;
   }
 
+  uint64_t first_code = morton_primitives[start].code_;
+  uint64_t last_code = morton_primitives[end - 1].code_;
+  int mid;
+  if (first_code == last_code || depth >= kMaxBVHDepth - 32) {
+    // Primitives in the same cell, or the tree is getting too deep, split in
+    // half so the remaining depth stays logarithmic
+    mid = start + (end - start) / 2;
+  } else {
+    int bit = 63 - __builtin_clzll(first_code ^ last_code);
+    mid = std::partition_point(
+              morton_primitives.begin() + start,
+              morton_primitives.begin() + end,
+              [bit](const MortonPrimitive& morton_primitive) {
+                return ((morton_primitive.code_ >> bit) & 1) == 0;
+              }) -
+          morton_primitives.begin();
+  }
+
+  int first_child = BuildLBVHNode(morton_primitives, build_primitives, start,
+                                  mid, depth + 1, leaf_block_width, lbvh_nodes);
+  int second_child =
+      BuildLBVHNode(morton_primitives, build_primitives, mid, end, depth + 1,
+                    leaf_block_width, lbvh_nodes);
+  LBVHNode& lbvh_node = lbvh_nodes[node];
+  lbvh_node.children_[0] = first_child;
+  lbvh_node.children_[1] = second_child;
+  lbvh_node.min_point_ = component_min(lbvh_nodes[first_child].min_point_,
+                                       lbvh_nodes[second_child].min_point_);
+  lbvh_node.max_point_ = component_max(lbvh_nodes[first_child].max_point_,
+                                       lbvh_nodes[second_child].max_point_);
+  lbvh_node.cost_ =
+      kTraversalCost *
+          SurfaceArea(lbvh_node.min_point_, lbvh_node.max_point_) +
+      lbvh_nodes[first_child].cost_ + lbvh_nodes[second_child].cost_;
   return node;
 }
 
-void BoundingVolumeHierarchyElement::PrintBVH(
-    const std::shared_ptr<BoundingVolumeHierarchyElement>& root) {
-  if (root) {
-    std::cout << "Node id: " << root->id_ << std::endl;
-    std::cout << "Min point: " << root->min_point_ << std::endl;
-    std::cout << "Max point: " << root->max_point_ << std::endl;
-    if (root->left_) {
-      std::cout << "Left child id: " << root->left_->id_ << std::endl;
+// Leaves of the treelets the restructuring reorganizes, the subsets of the
+// leaves are all evaluated, which costs 3^kTreeletLeafCount steps per treelet
+const int kTreeletLeafCount = 5;
+
+// A treelet root with the subtrees below it as leaves. The interior nodes
+// between them are reused for the new topology.
+struct Treelet {
+  int leaves_[kTreeletLeafCount];
+  int leaf_count_;
+  int interiors_[kTreeletLeafCount - 2];
+  int interior_count_;
+  // Bounds, lowest cost and the split of the lowest cost of every subset of
+  // the leaves, a bit per leaf
+  Vec3f min_points_[1 << kTreeletLeafCount];
+  Vec3f max_points_[1 << kTreeletLeafCount];
+  float costs_[1 << kTreeletLeafCount];
+  int splits_[1 << kTreeletLeafCount];
+};
+
+// Links the subtree over the leaves of subset in its lowest cost topology,
+// rooted at node or at an unused interior node of the treelet when node is -1.
+// Returns the root.
+static int RelinkTreelet(std::vector<LBVHNode>& lbvh_nodes, Treelet& treelet,
+                         int subset, int node) {
+  if ((subset & (subset - 1)) == 0) {
+    return treelet.leaves_[__builtin_ctz(subset)];
+  }
+  if (node < 0) {
+    node = treelet.interiors_[--treelet.interior_count_];
+  }
+  int split = treelet.splits_[subset];
+  int first_child = RelinkTreelet(lbvh_nodes, treelet, split, -1);
+  int second_child = RelinkTreelet(lbvh_nodes, treelet, subset ^ split, -1);
+  LBVHNode& lbvh_node = lbvh_nodes[node];
+  lbvh_node.children_[0] = first_child;
+  lbvh_node.children_[1] = second_child;
+  lbvh_node.min_point_ = treelet.min_points_[subset];
+  lbvh_node.max_point_ = treelet.max_points_[subset];
+  lbvh_node.cost_ = treelet.costs_[subset];
+  return node;
+}
+
+// Treelet restructuring after Karras and Aila, bottom up in one pass. The
+// treelet of every interior node is grown by opening its largest interior
+// leaf, then relinked in the topology of the lowest surface area heuristic
+// cost over its leaves. The Morton splits only look at centroids, this
+// recovers most of the quality the SAH builder gets from binning.
+static void RestructureTreelets(std::vector<LBVHNode>& lbvh_nodes, int node) {
+  if (lbvh_nodes[node].children_[0] < 0) {
+    return;
+  }
+  RestructureTreelets(lbvh_nodes, lbvh_nodes[node].children_[0]);
+  RestructureTreelets(lbvh_nodes, lbvh_nodes[node].children_[1]);
+
+  Treelet treelet;
+  treelet.leaves_[0] = lbvh_nodes[node].children_[0];
+  treelet.leaves_[1] = lbvh_nodes[node].children_[1];
+  treelet.leaf_count_ = 2;
+  treelet.interior_count_ = 0;
+  while (treelet.leaf_count_ < kTreeletLeafCount) {
+    int largest = -1;
+    float largest_area = -1.0f;
+    for (int i = 0; i < treelet.leaf_count_; i++) {
+      const LBVHNode& leaf = lbvh_nodes[treelet.leaves_[i]];
+      float area = SurfaceArea(leaf.min_point_, leaf.max_point_);
+      if (leaf.children_[0] >= 0 && area > largest_area) {
+        largest = i;
+        largest_area = area;
+      }
+    }
+    if (largest < 0) {
+      break;
+    }
+    int opened = treelet.leaves_[largest];
+    treelet.interiors_[treelet.interior_count_++] = opened;
+    treelet.leaves_[largest] = lbvh_nodes[opened].children_[0];
+    treelet.leaves_[treelet.leaf_count_++] = lbvh_nodes[opened].children_[1];
+  }
+
+  int full_subset = (1 << treelet.leaf_count_) - 1;
+  for (int subset = 1; subset <= full_subset; subset++) {
+    int lowest_leaf = __builtin_ctz(subset);
+    int rest = subset & (subset - 1);
+    const LBVHNode& leaf = lbvh_nodes[treelet.leaves_[lowest_leaf]];
+    if (rest == 0) {
+      treelet.min_points_[subset] = leaf.min_point_;
+      treelet.max_points_[subset] = leaf.max_point_;
+      treelet.costs_[subset] = leaf.cost_;
+      continue;
+    }
+    treelet.min_points_[subset] =
+        component_min(treelet.min_points_[rest], leaf.min_point_);
+    treelet.max_points_[subset] =
+        component_max(treelet.max_points_[rest], leaf.max_point_);
+
+    // Only the splits whose first part holds the lowest leaf, every
+    // partition of the subset is seen once
+    float best_cost = std::numeric_limits<float>::max();
+    int best_split = rest;
+    for (int split = (subset - 1) & subset; split;
+         split = (split - 1) & subset) {
+      if (!(split & (1 << lowest_leaf))) {
+        continue;
+      }
+      float cost = treelet.costs_[split] + treelet.costs_[subset ^ split];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_split = split;
+      }
     }
-    if (root->right_) {
-      std::cout << "Right child id: " << root->right_->id_ << std::endl;
+    treelet.costs_[subset] =
+        kTraversalCost * SurfaceArea(treelet.min_points_[subset],
+                                     treelet.max_points_[subset]) +
+        best_cost;
+    treelet.splits_[subset] = best_split;
+  }
+
+  RelinkTreelet(lbvh_nodes, treelet, full_subset, node);
+}
+
+static int LBVHDepth(const std::vector<LBVHNode>& lbvh_nodes, int node) {
+  if (lbvh_nodes[node].children_[0] < 0) {
+    return 1;
+  }
+  return 1 + std::max(LBVHDepth(lbvh_nodes, lbvh_nodes[node].children_[0]),
+                      LBVHDepth(lbvh_nodes, lbvh_nodes[node].children_[1]));
+}
+
+// Emits the subtree of an LBVH node into nodes in depth-first order and
+// returns the offset of its root
+static uint32_t FlattenLBVH(const std::vector<LBVHNode>& lbvh_nodes, int node,
+                            std::vector<LinearBVHNode>& nodes) {
+  const LBVHNode& lbvh_node = lbvh_nodes[node];
+  BuildBounds bounds;
+  bounds.min_point_ = lbvh_node.min_point_;
+  bounds.max_point_ = lbvh_node.max_point_;
+  uint32_t node_offset = AddNode(bounds, nodes);
+
+  if (lbvh_node.children_[0] < 0) {
+    InitializeLeaf(nodes[node_offset], lbvh_node.start_, lbvh_node.end_);
+    return node_offset;
+  }
+
+  // The axis the children are apart the most along, the child with the
+  // smaller centroid on it is emitted first as traversal expects
+  int first_child = lbvh_node.children_[0];
+  int second_child = lbvh_node.children_[1];
+  Vec3f separation =
+      (lbvh_nodes[second_child].min_point_ +
+       lbvh_nodes[second_child].max_point_) -
+      (lbvh_nodes[first_child].min_point_ + lbvh_nodes[first_child].max_point_);
+  Vec3f distance = component_max(separation, -separation);
+  int axis = distance.x > distance.y ? (distance.x > distance.z ? 0 : 2)
+                                     : (distance.y > distance.z ? 1 : 2);
+  nodes[node_offset].axis_ = axis;
+  if (component(separation, axis) < 0) {
+    std::swap(first_child, second_child);
+  }
+
+  FlattenLBVH(lbvh_nodes, first_child, nodes);
+  uint32_t second_child_offset = FlattenLBVH(lbvh_nodes, second_child, nodes);
+  nodes[node_offset].second_child_offset_ = second_child_offset;
+
+  return node_offset;
+}
+
+// Sorts the primitives along a Morton curve over their centroids and splits
+// them at the octree cells of the codes, in time linear in the primitives
+// apart from the per node binary search. 10 bits per axis tell a billion
+// cells apart, enough for smaller builds; larger ones get 21 bits per axis.
+// The Morton codes are computed on thread_pool when it is given.
+static void BuildLBVH(std::vector<BuildPrimitive>& build_primitives,
+                      bool restructure_treelets, int leaf_block_width,
+                      ThreadPool* thread_pool,
+                      std::vector<LinearBVHNode>& nodes) {
+  int primitive_count = build_primitives.size();
+  int bits_per_axis = primitive_count > (1 << 18) ? 21 : 10;
+  BuildBounds bounds = ComputeBuildBounds(build_primitives, 0, primitive_count);
+  Vec3f centroid_extent = bounds.centroid_max_ - bounds.centroid_min_;
+  float cell_count = float(1 << bits_per_axis);
+  Vec3f scale = {
+      centroid_extent.x > 0.0f ? cell_count / centroid_extent.x : 0.0f,
+      centroid_extent.y > 0.0f ? cell_count / centroid_extent.y : 0.0f,
+      centroid_extent.z > 0.0f ? cell_count / centroid_extent.z : 0.0f};
+
+  std::vector<MortonPrimitive> morton_primitives(primitive_count);
+  auto encode = [&](int, int chunk_start, int chunk_end) {
+    uint32_t max_cell = (1u << bits_per_axis) - 1;
+    for (int i = chunk_start; i < chunk_end; i++) {
+      Vec3f cell = hadamard(
+          build_primitives[i].centroid_ - bounds.centroid_min_, scale);
+      morton_primitives[i].code_ =
+          SpreadMortonBits(std::min(uint32_t(cell.x), max_cell)) << 2 |
+          SpreadMortonBits(std::min(uint32_t(cell.y), max_cell)) << 1 |
+          SpreadMortonBits(std::min(uint32_t(cell.z), max_cell));
+      morton_primitives[i].index_ = i;
+    }
+  };
+  if (thread_pool && thread_pool->Size() > 1) {
+    ForEachBuildChunk(*thread_pool, 0, primitive_count, encode);
+  } else {
+    encode(0, 0, primitive_count);
+  }
+  RadixSortMortonPrimitives(morton_primitives, 3 * bits_per_axis);
+
+  std::vector<BuildPrimitive> sorted_primitives(primitive_count);
+  for (int i = 0; i < primitive_count; i++) {
+    sorted_primitives[i] = build_primitives[morton_primitives[i].index_];
+  }
+  build_primitives.swap(sorted_primitives);
+
+  std::vector<LBVHNode> lbvh_nodes;
+  lbvh_nodes.reserve(2 * primitive_count - 1);
+  BuildLBVHNode(morton_primitives, build_primitives, 0, primitive_count, 0,
+                leaf_block_width, lbvh_nodes);
+
+  if (restructure_treelets) {
+    // Relinking can deepen the tree, past the traversal stack it is kept as
+    // the Morton splits left it
+    std::vector<LBVHNode> restructured_nodes = lbvh_nodes;
+    RestructureTreelets(restructured_nodes, 0);
+    if (LBVHDepth(restructured_nodes, 0) < kMaxBVHDepth) {
+      lbvh_nodes.swap(restructured_nodes);
+    }
+  }
+
+  FlattenLBVH(lbvh_nodes, 0, nodes);
+}
+
+// Builds on thread_pool when it is given, has more than one thread and there
+// are enough primitives to be worth it
+static void Build(std::vector<BuildPrimitive>& build_primitives,
+                  const BVHConstructionAlgorithm construction_algorithm,
+                  int leaf_block_width, ThreadPool* thread_pool,
+                  std::vector<LinearBVHNode>& nodes) {
+  nodes.reserve(2 * build_primitives.size() - 1);
+  bool parallel = thread_pool && thread_pool->Size() > 1 &&
+                  int(build_primitives.size()) >= kParallelBuildMinPrimitives;
+  switch (construction_algorithm) {
+    case BVHConstructionAlgorithm::kMedian:
+      if (parallel) {
+        BuildParallel(build_primitives, construction_algorithm,
+                      leaf_block_width, *thread_pool, nodes);
+      } else {
+        BuildMedianSplit(build_primitives, 0, build_primitives.size(), 0,
+                         leaf_block_width, nodes);
+      }
+      break;
+    case BVHConstructionAlgorithm::kSAH:
+      if (parallel) {
+        BuildParallel(build_primitives, construction_algorithm,
+                      leaf_block_width, *thread_pool, nodes);
+      } else {
+        BuildSAHSplit(build_primitives, 0, build_primitives.size(), 0,
+                      leaf_block_width, nodes);
+      }
+      break;
+    case BVHConstructionAlgorithm::kLBVH:
+    case BVHConstructionAlgorithm::kTreeletLBVH:
+      // Only the Morton codes are computed on the thread pool, the rest of
+      // the build is linear
+      BuildLBVH(
+          build_primitives,
+          construction_algorithm == BVHConstructionAlgorithm::kTreeletLBVH,
+          leaf_block_width, thread_pool, nodes);
+      break;
+  }
+}
+
+// Collapses the binary subtree at node_offset into wide nodes and returns the
+// offset of its root. Interior children with the largest surface area are
+// replaced by their own children until the node is full, so every wide node
+// takes over up to Width - 1 binary levels.
+template <int Width>
+static uint32_t CollapseNode(const std::vector<LinearBVHNode>& nodes,
+                             uint32_t node_offset,
+                             std::vector<WideBVHNode<Width>>& wide_nodes) {
+  uint32_t children[Width];
+  int child_count = 0;
+  if (nodes[node_offset].primitive_count_ > 0) {
+    children[child_count++] = node_offset;
+  } else {
+    children[child_count++] = node_offset + 1;
+    children[child_count++] = nodes[node_offset].second_child_offset_;
+  }
+
+  while (child_count < Width) {
+    int largest = -1;
+    float largest_area = -1.0f;
+    for (int i = 0; i < child_count; i++) {
+      const LinearBVHNode& child = nodes[children[i]];
+      float area = SurfaceArea(child.min_point_, child.max_point_);
+      if (child.primitive_count_ == 0 && area > largest_area) {
+        largest = i;
+        largest_area = area;
+      }
+    }
+    if (largest < 0) {
+      break;
+    }
+    uint32_t opened = children[largest];
+    children[largest] = opened + 1;
+    children[child_count++] = nodes[opened].second_child_offset_;
+  }
+
+  uint32_t wide_node_offset = wide_nodes.size();
+  wide_nodes.push_back(WideBVHNode<Width>());
+  for (int slot = 0; slot < WideBVHNode<Width>::kSlotCount; slot++) {
+    for (int axis = 0; axis < 3; axis++) {
+      wide_nodes[wide_node_offset].min_point_[axis][slot] =
+          std::numeric_limits<float>::infinity();
+      wide_nodes[wide_node_offset].max_point_[axis][slot] =
+          -std::numeric_limits<float>::infinity();
+    }
+    wide_nodes[wide_node_offset].child_offsets_[slot] = 0;
+    wide_nodes[wide_node_offset].primitive_counts_[slot] = 0;
+  }
+
+  for (int slot = 0; slot < child_count; slot++) {
+    const LinearBVHNode& child = nodes[children[slot]];
+    // The recursion grows wide_nodes, so the node is looked up again
+    uint32_t child_offset =
+        child.primitive_count_ > 0
+            ? child.primitives_offset_
+            : CollapseNode(nodes, children[slot], wide_nodes);
+    WideBVHNode<Width>& wide_node = wide_nodes[wide_node_offset];
+    for (int axis = 0; axis < 3; axis++) {
+      wide_node.min_point_[axis][slot] = component(child.min_point_, axis);
+      wide_node.max_point_[axis][slot] = component(child.max_point_, axis);
+    }
+    wide_node.child_offsets_[slot] = child_offset;
+    wide_node.primitive_counts_[slot] = child.primitive_count_;
+  }
+
+  return wide_node_offset;
+}
+
+static void BuildWideNodes(const std::vector<LinearBVHNode>& nodes,
+                           const BVHLayout layout,
+                           std::vector<WideBVHNode<4>>& bvh4_nodes,
+                           std::vector<WideBVHNode<8>>& bvh8_nodes) {
+  switch (layout) {
+    case BVHLayout::kBinary:
+      break;
+    case BVHLayout::kBVH4:
+      CollapseNode(nodes, 0, bvh4_nodes);
+      break;
+    case BVHLayout::kBVH8:
+      CollapseNode(nodes, 0, bvh8_nodes);
+      break;
+  }
+}
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(
+    const std::vector<std::shared_ptr<BoundingVolumeHierarchyElement>>&
+        primitives,
+    const BVHConstructionAlgorithm construction_algorithm,
+    const BVHLayout layout, ThreadPool* thread_pool) {
+  if (primitives.empty()) {
+    return;
+  }
+
+  // A box over the whole motion of a fast object is tested by nearly every
+  // ray, so the moving primitives are only bounded over a time segment each
+  std::vector<std::shared_ptr<BoundingVolumeHierarchyElement>>
+      static_primitives;
+  std::vector<std::shared_ptr<BoundingVolumeHierarchyElement>>
+      moving_primitives;
+  for (const auto& primitive : primitives) {
+    if (primitive->motion_.x != 0 || primitive->motion_.y != 0 ||
+        primitive->motion_.z != 0) {
+      moving_primitives.push_back(primitive);
+    } else {
+      static_primitives.push_back(primitive);
+    }
+  }
+
+  if (moving_primitives.empty()) {
+    BuildOverTime(primitives, construction_algorithm, layout, 0.0f, 1.0f,
+                  thread_pool);
+    return;
+  }
+
+  Vec3f min_point = {std::numeric_limits<float>::max(),
+                     std::numeric_limits<float>::max(),
+                     std::numeric_limits<float>::max()};
+  Vec3f max_point = -min_point;
+  if (!static_primitives.empty()) {
+    BuildOverTime(static_primitives, construction_algorithm, layout, 0.0f,
+                  1.0f, thread_pool);
+    min_point = min_point_;
+    max_point = max_point_;
+  }
+  for (int segment = 0; segment < kMotionBVHTimeSegments; segment++) {
+    std::shared_ptr<BoundingVolumeHierarchy> time_segment(
+        new BoundingVolumeHierarchy());
+    time_segment->BuildOverTime(
+        moving_primitives, construction_algorithm, layout,
+        float(segment) / kMotionBVHTimeSegments,
+        float(segment + 1) / kMotionBVHTimeSegments, thread_pool);
+    min_point = component_min(min_point, time_segment->min_point_);
+    max_point = component_max(max_point, time_segment->max_point_);
+    time_segments_.push_back(time_segment);
+  }
+
+  InitializeSelf(min_point, max_point);
+}
+
+void BoundingVolumeHierarchy::BuildOverTime(
+    const std::vector<std::shared_ptr<BoundingVolumeHierarchyElement>>&
+        primitives,
+    const BVHConstructionAlgorithm construction_algorithm,
+    const BVHLayout layout, float time_begin, float time_end,
+    ThreadPool* thread_pool) {
+  std::vector<BuildPrimitive> build_primitives(primitives.size());
+  for (size_t i = 0; i < primitives.size(); i++) {
+    const Vec3f& min_point = primitives[i]->min_point_;
+    const Vec3f& max_point = primitives[i]->max_point_;
+    const Vec3f& motion = primitives[i]->motion_;
+    build_primitives[i].min_point_ = component_min(
+        min_point + motion * time_begin, min_point + motion * time_end);
+    build_primitives[i].max_point_ = component_max(
+        max_point + motion * time_begin, max_point + motion * time_end);
+    build_primitives[i].centroid_ =
+        (build_primitives[i].min_point_ + build_primitives[i].max_point_) *
+        0.5f;
+    build_primitives[i].index_ = i;
+  }
+
+  Build(build_primitives, construction_algorithm, 1, thread_pool, nodes_);
+  BuildWideNodes(nodes_, layout, bvh4_nodes_, bvh8_nodes_);
+
+  primitives_.reserve(primitives.size());
+  for (const auto& build_primitive : build_primitives) {
+    primitives_.push_back(primitives[build_primitive.index_]);
+  }
+
+  InitializeSelf(nodes_[0].min_point_, nodes_[0].max_point_);
+}
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(
+    const std::vector<Vec3f>& primitive_min_points,
+    const std::vector<Vec3f>& primitive_max_points,
+    std::vector<uint32_t>& primitive_order,
+    const BVHConstructionAlgorithm construction_algorithm,
+    const BVHLayout layout, int leaf_block_width, ThreadPool* thread_pool) {
+  primitive_order.clear();
+  if (primitive_min_points.empty()) {
+    return;
+  }
+
+  std::vector<BuildPrimitive> build_primitives(primitive_min_points.size());
+  for (size_t i = 0; i < primitive_min_points.size(); i++) {
+    build_primitives[i].min_point_ = primitive_min_points[i];
+    build_primitives[i].max_point_ = primitive_max_points[i];
+    build_primitives[i].centroid_ =
+        (primitive_min_points[i] + primitive_max_points[i]) * 0.5f;
+    build_primitives[i].index_ = i;
+  }
+
+  Build(build_primitives, construction_algorithm, leaf_block_width,
+        thread_pool, nodes_);
+
+  // Slots are handed out to the leaves in node array order, which need not be
+  // the order of their primitive ranges once treelet restructuring relinked
+  // subtrees. Every leaf copies its range into the slots it gets, padded to
+  // whole blocks.
+  primitive_order.reserve(build_primitives.size());
+  for (LinearBVHNode& node : nodes_) {
+    if (node.primitive_count_ == 0) {
+      continue;
+    }
+    uint32_t first_slot = primitive_order.size();
+    for (uint32_t i = 0; i < node.primitive_count_; i++) {
+      primitive_order.push_back(
+          build_primitives[node.primitives_offset_ + i].index_);
+    }
+    uint32_t block_count =
+        (node.primitive_count_ + leaf_block_width - 1) / leaf_block_width;
+    primitive_order.resize(first_slot + block_count * leaf_block_width,
+                           kPaddingPrimitive);
+    node.primitives_offset_ = first_slot;
+  }
+
+  BuildWideNodes(nodes_, layout, bvh4_nodes_, bvh8_nodes_);
+
+  InitializeSelf(nodes_[0].min_point_, nodes_[0].max_point_);
+}
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(
+    std::vector<LinearBVHNode>&& nodes, const BVHLayout layout)
+    : nodes_(std::move(nodes)) {
+  if (nodes_.empty()) {
+    return;
+  }
+
+  BuildWideNodes(nodes_, layout, bvh4_nodes_, bvh8_nodes_);
+
+  InitializeSelf(nodes_[0].min_point_, nodes_[0].max_point_);
+}
+
+bool BoundingVolumeHierarchy::IntersectNode(const LinearBVHNode& node,
+                                            const Ray& ray,
+                                            float t_closest) {
+  // The direction signs pick the near and far planes of every slab, so each
+  // axis costs two multiplications and no swaps. Folding the valid range in
+  // with comparisons whose NaN results keep the previous bound makes rays
+  // parallel to a slab that start on its plane safe.
+  float t_entry = 0.0f;
+  float t_exit = t_closest;
+
+  float t_near =
+      ((ray.direction_negative_[0] ? node.max_point_.x : node.min_point_.x) -
+       ray.origin_.x) *
+      ray.inverse_direction_.x;
+  float t_far =
+      ((ray.direction_negative_[0] ? node.min_point_.x : node.max_point_.x) -
+       ray.origin_.x) *
+      ray.inverse_direction_.x;
+  t_entry = t_near > t_entry ? t_near : t_entry;
+  t_exit = t_far < t_exit ? t_far : t_exit;
+
+  t_near =
+      ((ray.direction_negative_[1] ? node.max_point_.y : node.min_point_.y) -
+       ray.origin_.y) *
+      ray.inverse_direction_.y;
+  t_far =
+      ((ray.direction_negative_[1] ? node.min_point_.y : node.max_point_.y) -
+       ray.origin_.y) *
+      ray.inverse_direction_.y;
+  t_entry = t_near > t_entry ? t_near : t_entry;
+  t_exit = t_far < t_exit ? t_far : t_exit;
+
+  t_near =
+      ((ray.direction_negative_[2] ? node.max_point_.z : node.min_point_.z) -
+       ray.origin_.z) *
+      ray.inverse_direction_.z;
+  t_far =
+      ((ray.direction_negative_[2] ? node.min_point_.z : node.max_point_.z) -
+       ray.origin_.z) *
+      ray.inverse_direction_.z;
+  t_entry = t_near > t_entry ? t_near : t_entry;
+  t_exit = t_far < t_exit ? t_far : t_exit;
+
+  // The box is hit in front of the origin and not behind the closest hit
+  return t_entry <= t_exit;
+}
+
+bool BoundingVolumeHierarchy::Intersect(const Ray& ray, HitRecord& hit,
+                                        bool backface_culling,
+                                        bool stop_at_any_hit) const {
+  // The primitives only write hits in front of hit.t_, which the traversal
+  // keeps equal to its closest distance
+  float closest_t_hit = hit.t_;
+  bool any_hit = false;
+
+  const BoundingVolumeHierarchy* tree = this;
+  auto intersect_primitive = [&](uint32_t slot, float& t_closest) {
+    if (tree->primitives_[slot]->Intersect(ray, hit, backface_culling,
+                                           stop_at_any_hit)) {
+      t_closest = hit.t_;
+      any_hit = true;
+      return true;
+    }
+    return false;
+  };
+
+  IntersectPrimitives(ray, closest_t_hit, intersect_primitive);
+  // The moving primitives only need to be closer than the static hit
+  if (!time_segments_.empty()) {
+    tree = &TimeSegment(ray.time_);
+    tree->IntersectPrimitives(ray, closest_t_hit, intersect_primitive);
+  }
+
+  return any_hit;
+}
+
+bool BoundingVolumeHierarchy::Occluded(const Ray& ray, float t_max) const {
+  if (OccludedPrimitives(ray, t_max, [&](uint32_t slot) {
+        return primitives_[slot]->Occluded(ray, t_max);
+      })) {
+    return true;
+  }
+  return !time_segments_.empty() &&
+         TimeSegment(ray.time_).Occluded(ray, t_max);
+}
+
+void BoundingVolumeHierarchyElement::IntersectPacket(
+    RayPacket& packet, uint32_t lane_mask, HitRecord* hits,
+    bool backface_culling) const {
+  for (uint32_t lanes = lane_mask; lanes; lanes &= lanes - 1) {
+    int lane = lowest_lane(lanes);
+    hits[lane].t_ = packet.t_closest_[lane];
+    if (Intersect(*packet.rays_[lane], hits[lane], backface_culling)) {
+      packet.t_closest_[lane] = hits[lane].t_;
+    }
+  }
+}
+
+void BoundingVolumeHierarchy::IntersectPacket(RayPacket& packet,
+                                              uint32_t lane_mask,
+                                              HitRecord* hits,
+                                              bool backface_culling) const {
+  IntersectPrimitivesPacket(
+      packet, lane_mask,
+      [&](uint32_t slot, uint32_t slot_lane_mask) {
+        primitives_[slot]->IntersectPacket(packet, slot_lane_mask, hits,
+                                           backface_culling);
+      },
+      [&](int lane, uint32_t slot, float& t_closest) {
+        hits[lane].t_ = t_closest;
+        if (primitives_[slot]->Intersect(*packet.rays_[lane], hits[lane],
+                                         backface_culling)) {
+          t_closest = hits[lane].t_;
+          return true;
+        }
+        return false;
+      });
+
+  if (time_segments_.empty()) {
+    return;
+  }
+
+  // The samples of a pixel spread over the shutter, every segment traces the
+  // lanes whose time falls into it
+  uint32_t segment_lane_masks[kMotionBVHTimeSegments] = {};
+  for (uint32_t lanes = lane_mask; lanes; lanes &= lanes - 1) {
+    int lane = lowest_lane(lanes);
+    segment_lane_masks[TimeSegmentIndex(packet.rays_[lane]->time_)] |=
+        1u << lane;
+  }
+  for (int segment = 0; segment < kMotionBVHTimeSegments; segment++) {
+    if (segment_lane_masks[segment]) {
+      time_segments_[segment]->IntersectPacket(
+          packet, segment_lane_masks[segment], hits, backface_culling);
+    }
+  }
+}
+
+void BoundingVolumeHierarchy::PrintBVH() const {
+  for (size_t i = 0; i < time_segments_.size(); i++) {
+    std::cout << "Time segment: " << i << std::endl;
+    time_segments_[i]->PrintBVH();
+  }
+
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    std::cout << "Node id: " << i << std::endl;
+    std::cout << "Min point: " << nodes_[i].min_point_ << std::endl;
+    std::cout << "Max point: " << nodes_[i].max_point_ << std::endl;
+    if (nodes_[i].primitive_count_ > 0) {
+      std::cout << "Primitives: " << nodes_[i].primitives_offset_ << " - "
+                << nodes_[i].primitives_offset_ + nodes_[i].primitive_count_
+                << std::endl;
+    } else {
+      std::cout << "Left child id: " << i + 1 << std::endl;
+      std::cout << "Right child id: " << nodes_[i].second_child_offset_
+                << std::endl;
     }
     std::cout << std::endl;
-    PrintBVH(root->left_);
-    PrintBVH(root->right_);
   }
 }
\ No newline at end of file
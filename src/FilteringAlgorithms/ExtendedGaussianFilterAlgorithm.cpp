@@ -4,7 +4,7 @@ void Scene::ExtendedGaussianFilterAlgorithm(Vec5f* image_sampled_data,
                                             int image_width, int image_height,
                                             int sample, Vec3f* image_data) {
   int gaussian_kernel_size = configuration_.sampling_.gaussian_kernel_size_ / 2;
-  for (int i = 0; i < image_height; i++) {
+  thread_pool_->ParallelFor(0, image_height, 8, [&](int i) {
     for (int j = 0; j < image_width; j++) {
       Vec3f sum{0.0f, 0.0f, 0.0f};
       float sum_of_weights = 0.0;
@@ -32,5 +32,5 @@ void Scene::ExtendedGaussianFilterAlgorithm(Vec5f* image_sampled_data,
       }
       image_data[i * image_width + j] = sum / sum_of_weights;
     }
-  }
+  });
 }
\ No newline at end of file
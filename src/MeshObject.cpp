@@ -1,8 +1,20 @@
 #include "MeshObject.hpp"
 
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <limits>
+#include <sstream>
+#include <unordered_map>
+
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
 
 typedef struct Vertex {
   float x, y, z; /* the usual 3-space position of a vertex */
@@ -29,28 +41,239 @@ PlyProperty face_props[] = {
      offsetof(Face, verts), 1, PLY_UCHAR, PLY_UCHAR, offsetof(Face, nverts)},
 };
 
+// Element of a PLY header with the size in bytes of each of its scalar
+// properties, 0 for list properties. The type of a list property is the type
+// of its items.
+struct PLYElement {
+  std::string name_;
+  size_t count_;
+  std::vector<std::string> property_names_;
+  std::vector<int> property_sizes_;
+  std::vector<std::string> property_types_;
+  // Size of the item count of list properties
+  std::vector<int> list_count_sizes_;
+};
+
+// Size in bytes of a PLY scalar type, 0 for unknown types
+static int PLYTypeSize(const std::string& type) {
+  if (type == "char" || type == "uchar" || type == "int8" ||
+      type == "uint8") {
+    return 1;
+  }
+  if (type == "short" || type == "ushort" || type == "int16" ||
+      type == "uint16") {
+    return 2;
+  }
+  if (type == "int" || type == "uint" || type == "int32" ||
+      type == "uint32" || type == "float" || type == "float32") {
+    return 4;
+  }
+  if (type == "double" || type == "float64") {
+    return 8;
+  }
+  return 0;
+}
+
+static bool IsPLYFloatType(const std::string& type) {
+  return type == "float" || type == "float32" || type == "double" ||
+         type == "float64";
+}
+
+// The 32 bit integer types, the only face index types the binary fast path
+// reads
+static bool IsPLYIndexType(const std::string& type) {
+  return type == "int" || type == "uint" || type == "int32" ||
+         type == "uint32";
+}
+
+// Parses the header of a binary little endian PLY file into its elements and
+// the offset of the data after it. Returns false for the other formats and
+// for headers it does not understand.
+static bool ParseBinaryPLYHeader(const char* data, size_t size,
+                                 std::vector<PLYElement>& elements,
+                                 size_t& data_offset) {
+  const char kEndHeader[] = "end_header";
+  const char* end_header =
+      std::search(data, data + size, kEndHeader,
+                  kEndHeader + sizeof(kEndHeader) - 1);
+  const char* header_end = std::find(end_header, data + size, '\n');
+  if (header_end == data + size) {
+    return false;
+  }
+  data_offset = header_end + 1 - data;
+
+  std::istringstream header(std::string(data, end_header));
+  std::string line;
+  std::getline(header, line);
+  if (line != "ply") {
+    return false;
+  }
+  while (std::getline(header, line)) {
+    std::istringstream words(line);
+    std::string keyword;
+    words >> keyword;
+    if (keyword == "format") {
+      std::string format;
+      words >> format;
+      if (format != "binary_little_endian") {
+        return false;
+      }
+    } else if (keyword == "element") {
+      PLYElement element;
+      words >> element.name_ >> element.count_;
+      elements.push_back(element);
+    } else if (keyword == "property") {
+      if (elements.empty()) {
+        return false;
+      }
+      PLYElement& element = elements.back();
+      std::string type;
+      std::string name;
+      words >> type;
+      if (type == "list") {
+        std::string count_type;
+        words >> count_type >> type >> name;
+        element.property_sizes_.push_back(0);
+        element.list_count_sizes_.push_back(PLYTypeSize(count_type));
+        if (!element.list_count_sizes_.back() || IsPLYFloatType(count_type) ||
+            !PLYTypeSize(type)) {
+          return false;
+        }
+      } else {
+        words >> name;
+        element.property_sizes_.push_back(PLYTypeSize(type));
+        if (!element.property_sizes_.back()) {
+          return false;
+        }
+      }
+      element.property_names_.push_back(name);
+      element.property_types_.push_back(type);
+    }
+  }
+  return !elements.empty();
+}
+
+// Bumped whenever the cache file layout or the BVH builders change, which
+// invalidates the cache files written before
+const int kMeshCacheVersion = 1;
+const char kMeshCacheMagic[8] = {'R', 'T', 'M', 'E', 'S', 'H', 'C', 'A'};
+
+// Start of a mesh cache file, followed by the vertices, the indices in leaf
+// order, the binary BVH nodes and the triangle blocks. The file is only read
+// back on the machine that wrote it, so everything is in native layout.
+struct MeshCacheHeader {
+  char magic_[8];
+  uint64_t key_;
+  uint64_t vertex_count_;
+  uint64_t index_count_;
+  uint64_t node_count_;
+  uint64_t triangle_block_float_count_;
+};
+
+// FNV-1a over 64 bit words, with a shift folding the high bits into the low
+// ones after every word. Hashing a file this way takes a fraction of the time
+// parsing it does.
+static uint64_t HashBytes(const char* data, size_t size,
+                          uint64_t hash = 14695981039346656037ull) {
+  const uint64_t kPrime = 1099511628211ull;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * kPrime;
+    hash ^= hash >> 32;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ uint8_t(data[i])) * kPrime;
+  }
+  return hash;
+}
+
+template <typename T>
+static const char* ReadCacheArray(const char* data, uint64_t count,
+                                  std::vector<T>& values) {
+  values.resize(count);
+  memcpy(values.data(), data, count * sizeof(T));
+  return data + count * sizeof(T);
+}
+
+template <typename T>
+static void WriteCacheArray(std::ofstream& file,
+                            const std::vector<T>& values) {
+  file.write(reinterpret_cast<const char*>(values.data()),
+             values.size() * sizeof(T));
+}
+
 MeshObject::MeshObject(std::shared_ptr<BaseMaterial> material,
                        const std::vector<RawFace>& raw_face_data,
                        const std::vector<Vec3f>& raw_vertex_data,
                        const Vec3f motion_blur, const Mat4x4f& transform_matrix,
-                       RawScalingFlip scaling_flip)
-    : BaseObject(material, motion_blur, transform_matrix, scaling_flip) {
+                       RawScalingFlip scaling_flip,
+                       const BVHConstructionAlgorithm bvh_construction_algorithm,
+                       const BVHLayout bvh_layout)
+    : BaseObject(material, motion_blur, transform_matrix, scaling_flip),
+      bvh_construction_algorithm_(bvh_construction_algorithm),
+      bvh_layout_(bvh_layout) {
+  // The scene vertex data is shared by all meshes, only the vertices this mesh
+  // references are copied
+  std::unordered_map<int, uint32_t> vertex_indices;
+  indices_.reserve(3 * raw_face_data.size());
   for (const auto& raw_face : raw_face_data) {
-    triangle_objects_.push_back(
-        std::dynamic_pointer_cast<BoundingVolumeHierarchyElement>(
-            std::make_shared<TriangleObject>(
-                material, raw_vertex_data[raw_face.v0_id - 1],
-                raw_vertex_data[raw_face.v1_id - 1],
-                raw_vertex_data[raw_face.v2_id - 1], Vec3f{0, 0, 0},
-                IDENTITY_MATRIX, RawScalingFlip{false, false, false})));
+    for (int vertex_id : {raw_face.v0_id, raw_face.v1_id, raw_face.v2_id}) {
+      auto vertex_index = vertex_indices.find(vertex_id);
+      if (vertex_index == vertex_indices.end()) {
+        vertex_index =
+            vertex_indices.emplace(vertex_id, vertices_.size()).first;
+        vertices_.push_back(raw_vertex_data[vertex_id - 1]);
+      }
+      indices_.push_back(vertex_index->second);
+    }
   }
 };
 
 MeshObject::MeshObject(std::shared_ptr<BaseMaterial> material,
                        const std::string& ply_filename, const Vec3f motion_blur,
                        const Mat4x4f& transform_matrix,
-                       RawScalingFlip scaling_flip)
-    : BaseObject(material, motion_blur, transform_matrix, scaling_flip) {
+                       RawScalingFlip scaling_flip,
+                       const BVHConstructionAlgorithm bvh_construction_algorithm,
+                       const BVHLayout bvh_layout,
+                       const std::string& bvh_cache_directory)
+    : BaseObject(material, motion_blur, transform_matrix, scaling_flip),
+      bvh_construction_algorithm_(bvh_construction_algorithm),
+      bvh_layout_(bvh_layout) {
+  MappedFile mapped_ply_file(ply_filename);
+
+  if (!bvh_cache_directory.empty()) {
+    // The key covers everything the cached data depends on, a changed PLY
+    // file or other BVH settings get a cache file of their own
+    int settings[] = {kMeshCacheVersion, int(bvh_construction_algorithm),
+                      int(bvh_layout), TriangleBlockWidth()};
+    cache_key_ = HashBytes(reinterpret_cast<const char*>(settings),
+                           sizeof(settings),
+                           HashBytes(mapped_ply_file.Data(),
+                                     mapped_ply_file.Size()));
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long)cache_key_);
+    size_t name_start = ply_filename.find_last_of('/');
+    cache_filename_ =
+        bvh_cache_directory + "/" +
+        ply_filename.substr(name_start == std::string::npos ? 0
+                                                            : name_start + 1) +
+        "." + key + ".bvh";
+    if (LoadCache()) {
+      return;
+    }
+  }
+
+  if (LoadBinaryPLY(mapped_ply_file.Data(), mapped_ply_file.Size())) {
+    return;
+  }
+  vertices_.clear();
+  indices_.clear();
+
+  // ASCII and big endian files, and the binary ones with properties the fast
+  // path does not read, go through the generic reader
   int nelems;
   char** elem_names;
   int file_type;
@@ -63,51 +286,38 @@ MeshObject::MeshObject(std::shared_ptr<BaseMaterial> material,
     std::cout << "Error reading file" << std::endl;
   }
 
-  std::vector<Vec3f> vertex_data_;
-
   for (int i = 0; i < nelems; i++) {
     PlyElement* elem = ply_file->elems[i];
     if (strcmp(elem->name, "vertex") == 0) {
       ply_get_property(ply_file, elem->name, &vert_props[0]);
       ply_get_property(ply_file, elem->name, &vert_props[1]);
       ply_get_property(ply_file, elem->name, &vert_props[2]);
+      vertices_.reserve(elem->num);
       for (size_t j = 0; j < elem->num; j++) {
         Vertex vertex;
         ply_get_element(ply_file, (void*)&vertex);
 
-        vertex_data_.push_back({vertex.x, vertex.y, vertex.z});
+        vertices_.push_back({vertex.x, vertex.y, vertex.z});
       }
     } else if (strcmp(elem->name, "face") == 0) {
       ply_get_property(ply_file, elem->name, &face_props[0]);
+      indices_.reserve(3 * elem->num);
 
       for (size_t j = 0; j < elem->num; j++) {
         Face face;
         ply_get_element(ply_file, (void*)&face);
 
         if (face.nverts == 3) {
-          triangle_objects_.push_back(
-              std::dynamic_pointer_cast<BoundingVolumeHierarchyElement>(
-                  std::make_shared<TriangleObject>(
-                      material, vertex_data_[face.verts[0]],
-                      vertex_data_[face.verts[1]], vertex_data_[face.verts[2]],
-                      Vec3f{0, 0, 0}, IDENTITY_MATRIX,
-                      RawScalingFlip{false, false, false})));
+          indices_.insert(indices_.end(),
+                          {uint32_t(face.verts[0]), uint32_t(face.verts[1]),
+                           uint32_t(face.verts[2])});
         } else if (face.nverts == 4) {
-          triangle_objects_.push_back(
-              std::dynamic_pointer_cast<BoundingVolumeHierarchyElement>(
-                  std::make_shared<TriangleObject>(
-                      material, vertex_data_[face.verts[0]],
-                      vertex_data_[face.verts[1]], vertex_data_[face.verts[2]],
-                      Vec3f{0, 0, 0}, IDENTITY_MATRIX,
-                      RawScalingFlip{false, false, false})));
-          triangle_objects_.push_back(
-              std::dynamic_pointer_cast<BoundingVolumeHierarchyElement>(
-                  std::make_shared<TriangleObject>(
-                      material, vertex_data_[face.verts[0]],
-                      vertex_data_[face.verts[2]], vertex_data_[face.verts[3]],
-                      Vec3f{0, 0, 0}, IDENTITY_MATRIX,
-                      RawScalingFlip{false, false, false})));
+          indices_.insert(indices_.end(),
+                          {uint32_t(face.verts[0]), uint32_t(face.verts[1]),
+                           uint32_t(face.verts[2]), uint32_t(face.verts[0]),
+                           uint32_t(face.verts[2]), uint32_t(face.verts[3])});
         }
+        free(face.verts);
       }
     }
   }
@@ -115,12 +325,129 @@ MeshObject::MeshObject(std::shared_ptr<BaseMaterial> material,
   ply_close(ply_file);
 }
 
-std::shared_ptr<BoundingVolumeHierarchyElement> MeshObject::Intersect(
-    Ray& ray, float& t_hit, Vec3f& intersection_normal, bool backface_culling,
-    bool stop_at_any_hit) const {
-  bool hit = false;
+bool MeshObject::LoadBinaryPLY(const char* data, size_t size) {
+  const uint16_t kByteOrderProbe = 1;
+  bool little_endian =
+      *reinterpret_cast<const uint8_t*>(&kByteOrderProbe) == 1;
+  std::vector<PLYElement> elements;
+  size_t offset;
+  if (!data || !little_endian ||
+      !ParseBinaryPLYHeader(data, size, elements, offset)) {
+    return false;
+  }
 
-  Vec3f temp_intersection_normal;
+  // Checks the elements first, so nothing is read from a file that falls
+  // back to the generic reader
+  for (const PLYElement& element : elements) {
+    bool has_lists = std::count(element.property_sizes_.begin(),
+                                element.property_sizes_.end(), 0) > 0;
+    if (element.name_ == "face") {
+      if (element.property_sizes_.size() != 1 || !has_lists ||
+          !IsPLYIndexType(element.property_types_[0])) {
+        return false;
+      }
+    } else if (has_lists) {
+      return false;
+    }
+  }
+
+  for (const PLYElement& element : elements) {
+    if (element.name_ == "face") {
+      int count_size = element.list_count_sizes_[0];
+      indices_.reserve(3 * element.count_);
+      for (size_t i = 0; i < element.count_; i++) {
+        if (offset + count_size > size) {
+          return false;
+        }
+        uint32_t vertex_count = 0;
+        memcpy(&vertex_count, data + offset, count_size);
+        offset += count_size;
+        if (offset + 4 * size_t(vertex_count) > size) {
+          return false;
+        }
+        uint32_t face[4];
+        if (vertex_count == 3 || vertex_count == 4) {
+          memcpy(face, data + offset, vertex_count * sizeof(uint32_t));
+          // Negative int indices wrap around to large ones and fail too
+          for (uint32_t j = 0; j < vertex_count; j++) {
+            if (face[j] >= vertices_.size()) {
+              return false;
+            }
+          }
+        }
+        if (vertex_count == 3) {
+          indices_.insert(indices_.end(), face, face + 3);
+        } else if (vertex_count == 4) {
+          indices_.insert(indices_.end(),
+                          {face[0], face[1], face[2], face[0], face[2],
+                           face[3]});
+        }
+        offset += 4 * size_t(vertex_count);
+      }
+      continue;
+    }
+
+    size_t stride = 0;
+    int coordinate_offsets[3] = {-1, -1, -1};
+    for (size_t j = 0; j < element.property_sizes_.size(); j++) {
+      const char* coordinates[3] = {"x", "y", "z"};
+      for (int axis = 0; axis < 3; axis++) {
+        if (element.property_names_[j] == coordinates[axis] &&
+            element.property_types_[j] == "float") {
+          coordinate_offsets[axis] = stride;
+        }
+      }
+      stride += element.property_sizes_[j];
+    }
+    if (offset + element.count_ * stride > size) {
+      return false;
+    }
+
+    if (element.name_ == "vertex") {
+      if (coordinate_offsets[0] < 0 || coordinate_offsets[1] < 0 ||
+          coordinate_offsets[2] < 0) {
+        return false;
+      }
+      vertices_.resize(element.count_);
+      if (stride == sizeof(Vec3f) && coordinate_offsets[0] == 0 &&
+          coordinate_offsets[1] == 4 && coordinate_offsets[2] == 8) {
+        // Positions only, the whole element is the vertex buffer
+        memcpy(vertices_.data(), data + offset, element.count_ * stride);
+      } else {
+        for (size_t i = 0; i < element.count_; i++) {
+          const char* vertex = data + offset + i * stride;
+          memcpy(&vertices_[i].x, vertex + coordinate_offsets[0], 4);
+          memcpy(&vertices_[i].y, vertex + coordinate_offsets[1], 4);
+          memcpy(&vertices_[i].z, vertex + coordinate_offsets[2], 4);
+        }
+      }
+    }
+    offset += element.count_ * stride;
+  }
+
+  return true;
+}
+
+bool MeshObject::Intersect(const Ray& ray, HitRecord& hit,
+                           bool backface_culling, bool stop_at_any_hit) const {
+  uint32_t triangle;
+  TriangleHit triangle_hit;
+
+  // Rays have unit directions, so without a transform the kernel t already
+  // is the world space distance and the closest hit so far culls triangles
+  if (identity_transform_) {
+    if (!IntersectTriangles(ray, hit.t_, backface_culling, stop_at_any_hit,
+                            triangle, triangle_hit)) {
+      return false;
+    }
+    hit.t_ = triangle_hit.t_;
+    hit.primitive_id_ = triangle;
+    hit.object_ = this;
+    hit.u_ = triangle_hit.u_;
+    hit.v_ = triangle_hit.v_;
+    hit.normal_ = TriangleNormal(triangle);
+    return true;
+  }
 
   Vec3f transformed_ray_origin =
       inverse_transform_matrix_ * (ray.origin_ - motion_blur_ * ray.time_);
@@ -132,77 +459,191 @@ std::shared_ptr<BoundingVolumeHierarchyElement> MeshObject::Intersect(
   Ray transformed_ray{ray.pixel_, transformed_ray_origin,
                       transformed_ray_direction, ray.diff_, ray.time_};
 
-  float mesh_hit = std::numeric_limits<float>::max();
-  if (left_) {
-    if (left_->Intersect(transformed_ray, mesh_hit, temp_intersection_normal,
-                         backface_culling, stop_at_any_hit)) {
-      hit = true;
+  if (!IntersectTriangles(transformed_ray, std::numeric_limits<float>::max(),
+                          backface_culling, stop_at_any_hit, triangle,
+                          triangle_hit)) {
+    return false;
+  }
+
+  Vec3f local_point =
+      transformed_ray.origin_ + triangle_hit.t_ * transformed_ray.direction_;
+  Vec3f local_point_destination = local_point + TriangleNormal(triangle);
+  Vec3f global_point = transform_matrix_ * local_point;
+  float t_hit = norm(global_point + motion_blur_ * ray.time_ - ray.origin_);
+  if (t_hit >= hit.t_) {
+    return false;
+  }
+  Vec3f global_point_destination = transform_matrix_ * local_point_destination;
+  hit.t_ = t_hit;
+  hit.primitive_id_ = triangle;
+  hit.object_ = this;
+  hit.u_ = triangle_hit.u_;
+  hit.v_ = triangle_hit.v_;
+  hit.normal_ = normalize(global_point_destination - global_point);
+  return true;
+}
+
+void MeshObject::IntersectPacket(RayPacket& packet, uint32_t lane_mask,
+                                 HitRecord* hits,
+                                 bool backface_culling) const {
+  // Transformed meshes would need a packet per object space, they fall back
+  // to single rays
+  if (!identity_transform_) {
+    BaseObject::IntersectPacket(packet, lane_mask, hits, backface_culling);
+    return;
+  }
+
+  uint32_t triangles[kRayPacketWidth];
+  TriangleHit lane_hits[kRayPacketWidth];
+  uint32_t hit_mask = 0;
+  auto intersect_triangle_packet = [&](uint32_t slot,
+                                       uint32_t slot_lane_mask) {
+    uint32_t slot_hit_mask = IntersectTrianglePacket(
+        slot, packet, slot_lane_mask, backface_culling, lane_hits);
+    for (uint32_t lanes = slot_hit_mask; lanes; lanes &= lanes - 1) {
+      triangles[lowest_lane(lanes)] = slot;
     }
+    hit_mask |= slot_hit_mask;
+  };
+
+  if (bvh_) {
+    bvh_->IntersectPrimitivesPacket(
+        packet, lane_mask, intersect_triangle_packet,
+        [&](int lane, uint32_t slot, float& t_closest) {
+          TriangleHit hit;
+          if (IntersectTriangle(slot, *packet.rays_[lane], backface_culling,
+                                hit) &&
+              hit.t_ < t_closest) {
+            t_closest = hit.t_;
+            triangles[lane] = slot;
+            lane_hits[lane] = hit;
+            hit_mask |= 1u << lane;
+            return true;
+          }
+          return false;
+        });
   } else {
-    for (size_t i = 0; i < triangle_objects_.size(); i++) {
-      float temp_hit = std::numeric_limits<float>::max();
-      Vec3f normal;
-      if (!triangle_objects_[i]->Intersect(transformed_ray, temp_hit, normal,
-                                           backface_culling, stop_at_any_hit)) {
+    for (uint32_t slot = 0; slot < TriangleCount(); slot++) {
+      intersect_triangle_packet(slot, lane_mask);
+    }
+  }
+
+  for (uint32_t lanes = hit_mask; lanes; lanes &= lanes - 1) {
+    int lane = lowest_lane(lanes);
+    hits[lane].primitive_id_ = triangles[lane];
+    hits[lane].object_ = this;
+    hits[lane].u_ = lane_hits[lane].u_;
+    hits[lane].v_ = lane_hits[lane].v_;
+    hits[lane].normal_ = TriangleNormal(triangles[lane]);
+  }
+}
+
+bool MeshObject::Occluded(const Ray& ray, float t_max) const {
+  return OccludedTriangles(TransformRayToObjectSpace(ray), t_max);
+}
+
+Vec3f MeshObject::TriangleNormal(uint32_t triangle) const {
+  // The block was just tested by the single ray queries and is still cached,
+  // unlike the indices and the vertices
+  if (!triangle_blocks_.empty()) {
+    int lane = triangle % triangle_block_width_;
+    Vec3f v0, edge1, edge2;
+    TriangleBlockLane(
+        triangle_blocks_.data() + kTriangleBlockComponents * (triangle - lane),
+        triangle_block_width_, lane, v0, edge1, edge2);
+    return normalize(cross(edge1, edge2));
+  }
+
+  const Vec3f& v0 = vertices_[indices_[3 * triangle]];
+  const Vec3f& v1 = vertices_[indices_[3 * triangle + 1]];
+  const Vec3f& v2 = vertices_[indices_[3 * triangle + 2]];
+  return normalize(cross(v1 - v0, v2 - v0));
+}
+
+bool MeshObject::IntersectTriangles(const Ray& ray, float t_max,
+                                    bool backface_culling,
+                                    bool stop_at_any_hit, uint32_t& triangle,
+                                    TriangleHit& hit) const {
+  float closest_t_hit = t_max;
+  bool any_hit = false;
+
+  if (bvh_) {
+    any_hit = bvh_->IntersectLeaves(
+        ray, closest_t_hit,
+        [&](uint32_t first_slot, uint32_t, float& t_closest) {
+          TriangleHit leaf_hit;
+          int lane = IntersectLeafBlock(first_slot, ray, backface_culling,
+                                        t_closest, leaf_hit);
+          if (lane < 0) {
+            return false;
+          }
+          t_closest = leaf_hit.t_;
+          triangle = first_slot + lane;
+          hit = leaf_hit;
+          return true;
+        });
+  } else {
+    for (uint32_t slot = 0; slot < TriangleCount(); slot++) {
+      TriangleHit slot_hit;
+      if (!IntersectTriangle(slot, ray, backface_culling, slot_hit) ||
+          slot_hit.t_ >= closest_t_hit) {
         continue;
       }
 
-      if (temp_hit < mesh_hit) {
-        mesh_hit = temp_hit;
-        temp_intersection_normal = normal;
-      }
-      hit = true;
+      closest_t_hit = slot_hit.t_;
+      triangle = slot;
+      hit = slot_hit;
+      any_hit = true;
       if (stop_at_any_hit) {
         break;
       }
     }
   }
-  if (hit) {
-    Vec3f local_point =
-        transformed_ray.origin_ + mesh_hit * transformed_ray.direction_;
-    Vec3f local_point_destination = local_point + temp_intersection_normal;
-    Vec3f global_point = transform_matrix_ * local_point;
-    Vec3f global_point_destination =
-        transform_matrix_ * local_point_destination;
-    Vec3f diff = global_point - ray.origin_;
-    t_hit = norm(diff);
-    Vec3f normalized_diff = normalize(diff);
-    ray.direction_.x = normalized_diff.x;
-    ray.direction_.y = normalized_diff.y;
-    ray.direction_.z = normalized_diff.z;
 
-    intersection_normal = normalize(global_point_destination - global_point);
+  return any_hit;
+}
+
+bool MeshObject::OccludedTriangles(const Ray& ray, float t_max) const {
+  auto occluded_triangle = [&](uint32_t triangle) {
+    TriangleHit hit;
+    return IntersectTriangle(triangle, ray, false, hit) && hit.t_ < t_max;
+  };
+
+  if (bvh_) {
+    return bvh_->OccludedLeaves(ray, t_max, [&](uint32_t first_slot, uint32_t) {
+      TriangleHit hit;
+      return IntersectLeafBlock(first_slot, ray, false, t_max, hit) >= 0;
+    });
   }
 
-  return hit ? std::dynamic_pointer_cast<BoundingVolumeHierarchyElement>(
-                   std::const_pointer_cast<BaseObject>(
-                       this->shared_from_this()))
-             : nullptr;
+  for (uint32_t triangle = 0; triangle < TriangleCount(); triangle++) {
+    if (occluded_triangle(triangle)) {
+      return true;
+    }
+  }
+  return false;
 }
 
 void MeshObject::Preprocess(bool high_level_bvh_enabled,
-                            bool low_level_bvh_enabled, bool) {
+                            bool low_level_bvh_enabled, bool,
+                            ThreadPool* thread_pool) {
   float x_min = std::numeric_limits<float>::max();
   float y_min = std::numeric_limits<float>::max();
   float z_min = std::numeric_limits<float>::max();
-  float x_max = std::numeric_limits<float>::min();
-  float y_max = std::numeric_limits<float>::min();
-  float z_max = std::numeric_limits<float>::min();
-
-  for (const auto& triangle_object : triangle_objects_) {
-    std::shared_ptr<TriangleObject> triangle_object_casted =
-        std::dynamic_pointer_cast<TriangleObject>(triangle_object);
-
-    triangle_object_casted->Preprocess(high_level_bvh_enabled,
-                                       low_level_bvh_enabled, false);
-
-    x_min = std::min(x_min, triangle_object->min_point_.x);
-    y_min = std::min(y_min, triangle_object->min_point_.y);
-    z_min = std::min(z_min, triangle_object->min_point_.z);
-    x_max = std::max(x_max, triangle_object->max_point_.x);
-    y_max = std::max(y_max, triangle_object->max_point_.y);
-    z_max = std::max(z_max, triangle_object->max_point_.z);
+  float x_max = -std::numeric_limits<float>::max();
+  float y_max = -std::numeric_limits<float>::max();
+  float z_max = -std::numeric_limits<float>::max();
+
+  for (const auto& vertex : vertices_) {
+    x_min = std::min(x_min, vertex.x);
+    y_min = std::min(y_min, vertex.y);
+    z_min = std::min(z_min, vertex.z);
+    x_max = std::max(x_max, vertex.x);
+    y_max = std::max(y_max, vertex.y);
+    z_max = std::max(z_max, vertex.z);
   }
+  object_min_point_ = Vec3f{x_min, y_min, z_min};
+  object_max_point_ = Vec3f{x_max, y_max, z_max};
 
   if (high_level_bvh_enabled || low_level_bvh_enabled) {
     Vec3f p0 = Vec3f{x_min, y_min, z_min};
@@ -223,27 +664,150 @@ void MeshObject::Preprocess(bool high_level_bvh_enabled,
     p6 = transform_matrix_ * p6;
     p7 = transform_matrix_ * p7;
 
-    Vec3f p0_motion = p0 + motion_blur_;
-    Vec3f p1_motion = p1 + motion_blur_;
-    Vec3f p2_motion = p2 + motion_blur_;
-    Vec3f p3_motion = p3 + motion_blur_;
-    Vec3f p4_motion = p4 + motion_blur_;
-    Vec3f p5_motion = p5 + motion_blur_;
-    Vec3f p6_motion = p6 + motion_blur_;
-    Vec3f p7_motion = p7 + motion_blur_;
+    Vec3f min_point = bounding_volume_min({p0, p1, p2, p3, p4, p5, p6, p7});
+    Vec3f max_point = bounding_volume_max({p0, p1, p2, p3, p4, p5, p6, p7});
+
+    InitializeSelf(min_point, max_point, motion_blur_);
+  }
+
+  // A BVH loaded from the cache comes with the triangles in its leaf order and
+  // their blocks
+  if (low_level_bvh_enabled && !bvh_) {
+    std::vector<Vec3f> triangle_min_points(TriangleCount());
+    std::vector<Vec3f> triangle_max_points(TriangleCount());
+    auto bound_triangle = [&](int triangle) {
+      const Vec3f& v0 = vertices_[indices_[3 * triangle]];
+      const Vec3f& v1 = vertices_[indices_[3 * triangle + 1]];
+      const Vec3f& v2 = vertices_[indices_[3 * triangle + 2]];
+      triangle_min_points[triangle] = component_min(v0, component_min(v1, v2));
+      triangle_max_points[triangle] = component_max(v0, component_max(v1, v2));
+    };
+    if (thread_pool) {
+      thread_pool->ParallelFor(0, TriangleCount(), kParallelBuildMinPrimitives,
+                               bound_triangle);
+    } else {
+      for (uint32_t triangle = 0; triangle < TriangleCount(); triangle++) {
+        bound_triangle(triangle);
+      }
+    }
+
+    std::vector<uint32_t> triangle_order;
+    triangle_block_width_ = TriangleBlockWidth();
+    bvh_ = std::make_shared<BoundingVolumeHierarchy>(
+        triangle_min_points, triangle_max_points, triangle_order,
+        bvh_construction_algorithm_, bvh_layout_, triangle_block_width_,
+        thread_pool);
+
+    std::vector<uint32_t> ordered_indices(3 * triangle_order.size(), 0);
+    for (size_t slot = 0; slot < triangle_order.size(); slot++) {
+      if (triangle_order[slot] == kPaddingPrimitive) {
+        continue;
+      }
+      ordered_indices[3 * slot] = indices_[3 * triangle_order[slot]];
+      ordered_indices[3 * slot + 1] = indices_[3 * triangle_order[slot] + 1];
+      ordered_indices[3 * slot + 2] = indices_[3 * triangle_order[slot] + 2];
+    }
+    indices_.swap(ordered_indices);
+
+    BuildTriangleBlocks();
+
+    if (!cache_filename_.empty() && !bvh_->nodes_.empty()) {
+      SaveCache();
+    }
+  }
 
-    Vec3f min_point = bounding_volume_min(
-        {p0, p1, p2, p3, p4, p5, p6, p7, p0_motion, p1_motion, p2_motion,
-         p3_motion, p4_motion, p5_motion, p6_motion, p7_motion});
-    Vec3f max_point = bounding_volume_max(
-        {p0, p1, p2, p3, p4, p5, p6, p7, p0_motion, p1_motion, p2_motion,
-         p3_motion, p4_motion, p5_motion, p6_motion, p7_motion});
+  // Vertices no triangle references do not widen the root of the BVH. A mesh
+  // without triangles has an empty BVH whose bounds are never set.
+  if (bvh_ && !bvh_->nodes_.empty()) {
+    object_min_point_ = bvh_->min_point_;
+    object_max_point_ = bvh_->max_point_;
+  }
+}
 
-    InitializeSelf(min_point, max_point);
+bool MeshObject::LoadCache() {
+  MappedFile cache_file(cache_filename_);
+  if (cache_file.Size() < sizeof(MeshCacheHeader)) {
+    return false;
+  }
+  MeshCacheHeader header;
+  memcpy(&header, cache_file.Data(), sizeof(header));
+  if (memcmp(header.magic_, kMeshCacheMagic, sizeof(header.magic_)) != 0 ||
+      header.key_ != cache_key_ ||
+      cache_file.Size() !=
+          sizeof(header) + header.vertex_count_ * sizeof(Vec3f) +
+              header.index_count_ * sizeof(uint32_t) +
+              header.node_count_ * sizeof(LinearBVHNode) +
+              header.triangle_block_float_count_ * sizeof(float)) {
+    return false;
   }
 
-  if (low_level_bvh_enabled) {
-    left_ = BoundingVolumeHierarchyElement::Construct(
-        triangle_objects_, 0, triangle_objects_.size(), 0);
+  const char* data = cache_file.Data() + sizeof(header);
+  data = ReadCacheArray(data, header.vertex_count_, vertices_);
+  data = ReadCacheArray(data, header.index_count_, indices_);
+  std::vector<LinearBVHNode> nodes;
+  data = ReadCacheArray(data, header.node_count_, nodes);
+  ReadCacheArray(data, header.triangle_block_float_count_, triangle_blocks_);
+
+  triangle_block_width_ = TriangleBlockWidth();
+  bvh_ = std::make_shared<BoundingVolumeHierarchy>(std::move(nodes),
+                                                   bvh_layout_);
+  return true;
+}
+
+void MeshObject::SaveCache() const {
+  size_t directory_end = cache_filename_.find_last_of('/');
+  mkdir(cache_filename_.substr(0, directory_end).c_str(), 0755);
+
+  MeshCacheHeader header;
+  memcpy(header.magic_, kMeshCacheMagic, sizeof(header.magic_));
+  header.key_ = cache_key_;
+  header.vertex_count_ = vertices_.size();
+  header.index_count_ = indices_.size();
+  header.node_count_ = bvh_->nodes_.size();
+  header.triangle_block_float_count_ = triangle_blocks_.size();
+
+  // Written to a file of its own next to the cache file and renamed over it
+  // once complete, so runs sharing the directory never load a partial file.
+  // mkstemp makes the name unique to this writer, meshes of the same PLY file
+  // are preprocessed concurrently and share the cache file.
+  std::string temporary_filename = cache_filename_ + ".XXXXXX";
+  int file_descriptor = mkstemp(&temporary_filename[0]);
+  if (file_descriptor < 0) {
+    std::cout << "Error writing BVH cache " << cache_filename_ << std::endl;
+    return;
+  }
+  fchmod(file_descriptor, 0644);
+  close(file_descriptor);
+  std::ofstream file(temporary_filename, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  WriteCacheArray(file, vertices_);
+  WriteCacheArray(file, indices_);
+  WriteCacheArray(file, bvh_->nodes_);
+  WriteCacheArray(file, triangle_blocks_);
+  file.close();
+
+  if (!file ||
+      std::rename(temporary_filename.c_str(), cache_filename_.c_str()) != 0) {
+    std::remove(temporary_filename.c_str());
+    std::cout << "Error writing BVH cache " << cache_filename_ << std::endl;
+  }
+}
+
+void MeshObject::BuildTriangleBlocks() {
+  triangle_blocks_.clear();
+  triangle_blocks_.reserve(kTriangleBlockComponents * TriangleCount());
+
+  std::vector<Vec3f> block_vertices;
+  for (uint32_t first_slot = 0; first_slot < TriangleCount();
+       first_slot += triangle_block_width_) {
+    block_vertices.clear();
+    for (uint32_t slot = first_slot; slot < first_slot + triangle_block_width_;
+         slot++) {
+      block_vertices.push_back(vertices_[indices_[3 * slot]]);
+      block_vertices.push_back(vertices_[indices_[3 * slot + 1]]);
+      block_vertices.push_back(vertices_[indices_[3 * slot + 2]]);
+    }
+    AppendTriangleBlock(block_vertices.data(), triangle_block_width_,
+                        triangle_blocks_);
   }
 }
\ No newline at end of file
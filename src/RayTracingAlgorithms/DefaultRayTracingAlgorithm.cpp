@@ -1,8 +1,7 @@
 #include "Scene.hpp"
 
 Vec3f Scene::DefaultRayTracingAlgorithm(
-    Ray& ray,
-    const std::shared_ptr<BoundingVolumeHierarchyElement> inside_object_ptr,
-    int, int) {
+    const Ray& ray, const BoundingVolumeHierarchyElement* inside_object_ptr,
+    int, int, int, PCG32&, const HitRecord*) {
   return {0, 0, 0};
 }
\ No newline at end of file
@@ -3,58 +3,57 @@
 #include "Scene.hpp"
 
 Vec3f Scene::RecursiveRayTracingAlgorithm(
-    Ray &ray,
-    const std::shared_ptr<BoundingVolumeHierarchyElement> inside_object_ptr,
-    int remaining_recursion, int max_recursion)
+    const Ray &ray, const BoundingVolumeHierarchyElement *inside_object_ptr,
+    int remaining_recursion, int max_recursion, int sample_index,
+    PCG32 &random, const HitRecord *primary_hit)
 {
   Vec3f pixel_value = {0, 0, 0};
-  float t_hit = std::numeric_limits<float>::max();
-  Vec3f hit_normal;
-  std::shared_ptr<BoundingVolumeHierarchyElement> hit_object_ptr = nullptr;
+  HitRecord hit;
+  hit.t_ = std::numeric_limits<float>::max();
+  hit.object_ = nullptr;
 
-  if (inside_object_ptr == nullptr)
+  if (primary_hit)
+  {
+    hit = *primary_hit;
+  }
+  else if (inside_object_ptr == nullptr)
   {
     if (configuration_.acceleration_.bvh_high_level_)
     {
-      hit_object_ptr = bvh_root_->Intersect(ray, t_hit, hit_normal);
+      bvh_root_->Intersect(ray, hit);
     }
     else
     {
-      for (auto object : objects_)
+      for (const auto &object : objects_)
       {
-        float temp_hit = std::numeric_limits<float>::max();
-        Vec3f normal;
-        std::shared_ptr<BaseObject> hit_object_casted =
-            std::dynamic_pointer_cast<BaseObject>(object);
-        if (object->Intersect(ray, temp_hit, normal))
-        {
-          if (t_hit > temp_hit)
-          {
-            t_hit = temp_hit;
-            hit_object_ptr = object;
-            hit_normal = normal;
-          }
-        }
+        object->Intersect(ray, hit);
       }
     }
   }
   else
   {
-    hit_object_ptr = inside_object_ptr;
-    inside_object_ptr->Intersect(ray, t_hit, hit_normal, false);
-    if (dot(ray.direction_, hit_normal) > 0)
+    inside_object_ptr->Intersect(ray, hit, false);
+    hit.object_ = inside_object_ptr;
+    if (dot(ray.direction_, hit.normal_) > 0)
     {
-      hit_normal = -hit_normal;
+      hit.normal_ = -hit.normal_;
     }
   }
 
+  const BoundingVolumeHierarchyElement *hit_object_ptr = hit.object_;
+  const float t_hit = hit.t_;
+  const Vec3f &hit_normal = hit.normal_;
+
   if (hit_object_ptr)
   {
-    std::shared_ptr<BaseObject> hit_object_casted =
-        std::dynamic_pointer_cast<BaseObject>(hit_object_ptr);
+    // Every element of the scene is an object, its material record is looked
+    // up by id instead of casting the material classes
+    const BaseObject *hit_object =
+        static_cast<const BaseObject *>(hit_object_ptr);
     // This is where the fun begins
 
-    std::shared_ptr<BaseMaterial> material_ptr = hit_object_casted->material_;
+    const MaterialRecord &material =
+        material_records_[hit_object->material_id_];
 
     if (!inside_object_ptr)
     {
@@ -63,7 +62,7 @@ Vec3f Scene::RecursiveRayTracingAlgorithm(
         for (auto ambient_light : ambient_lights_)
         {
           pixel_value +=
-              hadamard(material_ptr->ambient_, ambient_light->intensity_);
+              hadamard(material.ambient_, ambient_light->intensity_);
         }
       }
     }
@@ -81,29 +80,19 @@ Vec3f Scene::RecursiveRayTracingAlgorithm(
         float distance_to_light =
             norm2(point_light->position_ - intersection_point);
         bool is_in_shadow = false;
-        float shadow_hit = std::numeric_limits<float>::max();
-        Vec3f shadow_normal;
         if (configuration_.acceleration_.bvh_high_level_)
         {
-          auto ret = bvh_root_->Intersect(shadow_ray, shadow_hit, shadow_normal,
-                                          false);
-          if (ret && (shadow_hit < sqrt(distance_to_light)))
-          {
-            is_in_shadow = true;
-          }
+          is_in_shadow =
+              bvh_root_->Occluded(shadow_ray, sqrt(distance_to_light));
         }
         else
         {
           for (auto object : objects_)
           {
-            if (object->Intersect(shadow_ray, shadow_hit, shadow_normal,
-                                  false))
+            if (object->Occluded(shadow_ray, sqrt(distance_to_light)))
             {
-              if (shadow_hit < sqrt(distance_to_light))
-              {
-                is_in_shadow = true;
-                break;
-              }
+              is_in_shadow = true;
+              break;
             }
           }
         }
@@ -115,7 +104,7 @@ Vec3f Scene::RecursiveRayTracingAlgorithm(
           if (configuration_.shading_.diffuse_)
           {
             Vec3f diffuse_term =
-                hadamard(material_ptr->diffuse_,
+                hadamard(material.diffuse_,
                          point_light->intensity_ / distance_to_light) *
                 std::max(0.0f, dot(hit_normal, light_direction));
             pixel_value += diffuse_term;
@@ -123,24 +112,31 @@ Vec3f Scene::RecursiveRayTracingAlgorithm(
 
           if (configuration_.shading_.specular_)
           {
-            if (material_ptr->phong_exponent_ >= 0.0f)
+            if (material.phong_exponent_ >= 0.0f)
             {
               Vec3f half_vector = normalize(light_direction - ray.direction_);
               Vec3f specular_term = {0, 0, 0};
               specular_term =
-                  hadamard(material_ptr->specular_,
+                  hadamard(material.specular_,
                            point_light->intensity_ / distance_to_light) *
                   pow(std::max(0.0f, dot(hit_normal, half_vector)),
-                      material_ptr->phong_exponent_);
+                      material.phong_exponent_);
               pixel_value += specular_term;
             }
           }
         }
       }
 
-      for (auto area_light : area_lights_)
+      // The samples of a pixel are stratified over each light, every bounce
+      // scrambles them differently
+      const uint64_t shading_seed =
+          pixel_seed(ray.pixel_) ^ (uint64_t(remaining_recursion) << 32);
+      for (size_t light_index = 0; light_index < area_lights_.size();
+           light_index++)
       {
-        std::vector<Vec2f> diff = area_light_sampling_algorithm_(1);
+        const auto &area_light = area_lights_[light_index];
+        Vec2f diff = area_light_sampler_.Get2D(sample_index,
+                                               shading_seed ^ light_index);
 
         Vec3f area_light_position = area_light->position_;
 
@@ -174,7 +170,7 @@ Vec3f Scene::RecursiveRayTracingAlgorithm(
         Vec3f u = normalize(cross(normal_prime, area_light_normal));
         Vec3f v = cross(area_light_normal, u);
 
-        area_light_position = area_light_position + area_light->size_ * (u * (2.0 * diff[0].x - 1.0f) + v * (2.0 * diff[0].y - 1.0f));
+        area_light_position = area_light_position + area_light->size_ * (u * (2.0 * diff.x - 1.0f) + v * (2.0 * diff.y - 1.0f));
 
         Ray shadow_ray = {
             ray.pixel_, intersection_point,
@@ -183,29 +179,19 @@ Vec3f Scene::RecursiveRayTracingAlgorithm(
         float distance_to_light =
             norm2(area_light_position - intersection_point);
         bool is_in_shadow = false;
-        float shadow_hit = std::numeric_limits<float>::max();
-        Vec3f shadow_normal;
         if (configuration_.acceleration_.bvh_high_level_)
         {
-          auto ret = bvh_root_->Intersect(shadow_ray, shadow_hit, shadow_normal,
-                                          false);
-          if (ret && (shadow_hit < sqrt(distance_to_light)))
-          {
-            is_in_shadow = true;
-          }
+          is_in_shadow =
+              bvh_root_->Occluded(shadow_ray, sqrt(distance_to_light));
         }
         else
         {
           for (auto object : objects_)
           {
-            if (object->Intersect(shadow_ray, shadow_hit, shadow_normal,
-                                  false))
+            if (object->Occluded(shadow_ray, sqrt(distance_to_light)))
             {
-              if (shadow_hit < sqrt(distance_to_light))
-              {
-                is_in_shadow = true;
-                break;
-              }
+              is_in_shadow = true;
+              break;
             }
           }
         }
@@ -221,7 +207,7 @@ Vec3f Scene::RecursiveRayTracingAlgorithm(
           if (configuration_.shading_.diffuse_)
           {
             Vec3f diffuse_term =
-                hadamard(material_ptr->diffuse_,
+                hadamard(material.diffuse_,
                          area_light->radiance_ * irradiance_coeff) *
                 std::max(0.0f, dot(hit_normal, light_direction));
             pixel_value += diffuse_term;
@@ -229,15 +215,15 @@ Vec3f Scene::RecursiveRayTracingAlgorithm(
 
           if (configuration_.shading_.specular_)
           {
-            if (material_ptr->phong_exponent_ >= 0.0f)
+            if (material.phong_exponent_ >= 0.0f)
             {
               Vec3f half_vector = normalize(light_direction - ray.direction_);
               Vec3f specular_term = {0, 0, 0};
               specular_term =
-                  hadamard(material_ptr->specular_,
+                  hadamard(material.specular_,
                            area_light->radiance_ * irradiance_coeff) *
                   pow(std::max(0.0f, dot(hit_normal, half_vector)),
-                      material_ptr->phong_exponent_);
+                      material.phong_exponent_);
               pixel_value += specular_term;
             }
           }
@@ -247,16 +233,9 @@ Vec3f Scene::RecursiveRayTracingAlgorithm(
 
     if (remaining_recursion > 0)
     {
-      MirrorMaterial *mirror_material_ptr =
-          dynamic_cast<MirrorMaterial *>(material_ptr.get());
-      ConductorMaterial *conductor_material_ptr =
-          dynamic_cast<ConductorMaterial *>(material_ptr.get());
-      DielectricMaterial *dielectric_material_ptr =
-          dynamic_cast<DielectricMaterial *>(material_ptr.get());
-
       Vec3f distorted_normal = hit_normal;
 
-      if (material_ptr->roughness_ > 0.0f)
+      if (material.roughness_ > 0.0f)
       {
         Vec3f normal_prime = hit_normal;
         int min_index = 0;
@@ -288,116 +267,122 @@ Vec3f Scene::RecursiveRayTracingAlgorithm(
         Vec3f v = cross(hit_normal, u);
 
         distorted_normal = normalize(
-            hit_normal + material_ptr->roughness_ *
-                             (u * (((float)rand() / RAND_MAX) - 0.5f) +
-                              v * (((float)rand() / RAND_MAX) - 0.5f)));
+            hit_normal + material.roughness_ *
+                             (u * (random.NextFloat() - 0.5f) +
+                              v * (random.NextFloat() - 0.5f)));
       }
 
-      if (mirror_material_ptr && configuration_.materials_.mirror_)
+      switch (material.type_)
       {
-        Vec3f reflection_direction =
-            ray.direction_ -
-            2 * dot(ray.direction_, distorted_normal) * distorted_normal;
-        Ray reflection_ray = {ray.pixel_, intersection_point,
-                              reflection_direction, ray.diff_, ray.time_};
-        Vec3f reflection_color = RecursiveRayTracingAlgorithm(
-            reflection_ray, inside_object_ptr, remaining_recursion - 1,
-            max_recursion);
-        pixel_value += hadamard(reflection_color, mirror_material_ptr->mirror_);
-      }
-      else if (conductor_material_ptr &&
-               configuration_.materials_.conductor_)
-      {
-        Vec3f reflection_direction =
-            ray.direction_ -
-            2 * dot(ray.direction_, distorted_normal) * distorted_normal;
-        Ray reflection_ray = {ray.pixel_, intersection_point,
-                              reflection_direction, ray.diff_, ray.time_};
-        Vec3f reflection_color = RecursiveRayTracingAlgorithm(
-            reflection_ray, inside_object_ptr, remaining_recursion - 1,
-            max_recursion);
-
-        float n2 = conductor_material_ptr->refraction_index_;
-        float k2 = conductor_material_ptr->absorption_index_;
-        float cos_theta = -dot(ray.direction_, distorted_normal);
-        float n2_k2_2 = n2 * n2 + k2 * k2;
-        float n2_cos_theta_tw = 2 * n2 * cos_theta;
-        float cos_theta_2 = cos_theta * cos_theta;
-        float rs = (n2_k2_2 - n2_cos_theta_tw + cos_theta_2) /
-                   (n2_k2_2 + n2_cos_theta_tw + cos_theta_2);
-        float rp = (n2_k2_2 * cos_theta_2 - n2_cos_theta_tw + 1) /
-                   (n2_k2_2 * cos_theta_2 + n2_cos_theta_tw + 1);
-        float fresnel_reflection_ratio = (rs + rp) / 2;
-
-        pixel_value +=
-            hadamard(reflection_color, conductor_material_ptr->mirror_ *
-                                           fresnel_reflection_ratio);
-      }
-      else if (dielectric_material_ptr &&
-               configuration_.materials_.dielectric_)
-      {
-        Vec3f reflection_color = {0, 0, 0};
-        Vec3f reflection_direction =
-            ray.direction_ -
-            2 * dot(ray.direction_, distorted_normal) * distorted_normal;
-        Ray reflection_ray = {ray.pixel_, intersection_point,
-                              reflection_direction, ray.diff_, ray.time_};
-        reflection_color = RecursiveRayTracingAlgorithm(
-            reflection_ray, inside_object_ptr, remaining_recursion - 1,
-            max_recursion);
-
-        float n1 = inside_object_ptr
-                       ? dielectric_material_ptr->refraction_index_
-                       : 1.0f;
-        float n2 = inside_object_ptr
-                       ? 1.0
-                       : dielectric_material_ptr->refraction_index_;
-
-        float cos_theta = dot(-ray.direction_, distorted_normal);
-        float cos_phi_2 =
-            1 - (n1 * n1 / (n2 * n2)) * (1 - cos_theta * cos_theta);
-        if (cos_phi_2 > 0.0)
+      case MaterialType::kMirror:
+        if (configuration_.materials_.mirror_)
         {
-          float cos_phi = sqrt(cos_phi_2);
-          float r_p =
-              (n1 * cos_theta - n2 * cos_phi) / (n1 * cos_theta + n2 * cos_phi);
-          float r_s =
-              (n1 * cos_phi - n2 * cos_theta) / (n1 * cos_phi + n2 * cos_theta);
-
-          float fresnel_reflection_ratio = (r_p * r_p + r_s * r_s) / 2;
-          float fresnel_transmission_ratio = 1.0 - fresnel_reflection_ratio;
-
-          Vec3f refraction_direction =
-              normalize((n1 / n2) * ray.direction_ +
-                        (n1 / n2 * cos_theta - cos_phi) * distorted_normal);
-          Ray refraction_ray = {
-              ray.pixel_,
-              intersection_point - 2 * shadow_ray_epsilon_ * distorted_normal,
-              refraction_direction, ray.diff_, ray.time_};
-          // If the object type is triangle, inside_object_ptr is nullptr, check
-          // later
-          Vec3f refraction_color = RecursiveRayTracingAlgorithm(
-              refraction_ray, inside_object_ptr ? nullptr : hit_object_casted,
-              remaining_recursion - 1, max_recursion);
-          pixel_value += reflection_color * fresnel_reflection_ratio;
-          pixel_value += refraction_color * fresnel_transmission_ratio;
+          Vec3f reflection_direction =
+              ray.direction_ -
+              2 * dot(ray.direction_, distorted_normal) * distorted_normal;
+          Ray reflection_ray = {ray.pixel_, intersection_point,
+                                reflection_direction, ray.diff_, ray.time_};
+          Vec3f reflection_color = RecursiveRayTracingAlgorithm(
+              reflection_ray, inside_object_ptr, remaining_recursion - 1,
+              max_recursion, sample_index, random, nullptr);
+          pixel_value += hadamard(reflection_color, material.mirror_);
         }
-        else
+        break;
+      case MaterialType::kConductor:
+        if (configuration_.materials_.conductor_)
+        {
+          Vec3f reflection_direction =
+              ray.direction_ -
+              2 * dot(ray.direction_, distorted_normal) * distorted_normal;
+          Ray reflection_ray = {ray.pixel_, intersection_point,
+                                reflection_direction, ray.diff_, ray.time_};
+          Vec3f reflection_color = RecursiveRayTracingAlgorithm(
+              reflection_ray, inside_object_ptr, remaining_recursion - 1,
+              max_recursion, sample_index, random, nullptr);
+
+          float n2 = material.refraction_index_;
+          float k2 = material.absorption_index_;
+          float cos_theta = -dot(ray.direction_, distorted_normal);
+          float n2_k2_2 = n2 * n2 + k2 * k2;
+          float n2_cos_theta_tw = 2 * n2 * cos_theta;
+          float cos_theta_2 = cos_theta * cos_theta;
+          float rs = (n2_k2_2 - n2_cos_theta_tw + cos_theta_2) /
+                     (n2_k2_2 + n2_cos_theta_tw + cos_theta_2);
+          float rp = (n2_k2_2 * cos_theta_2 - n2_cos_theta_tw + 1) /
+                     (n2_k2_2 * cos_theta_2 + n2_cos_theta_tw + 1);
+          float fresnel_reflection_ratio = (rs + rp) / 2;
+
+          pixel_value +=
+              hadamard(reflection_color, material.mirror_ *
+                                             fresnel_reflection_ratio);
+        }
+        break;
+      case MaterialType::kDielectric:
+        if (configuration_.materials_.dielectric_)
         {
-          pixel_value += reflection_color;
+          Vec3f reflection_color = {0, 0, 0};
+          Vec3f reflection_direction =
+              ray.direction_ -
+              2 * dot(ray.direction_, distorted_normal) * distorted_normal;
+          Ray reflection_ray = {ray.pixel_, intersection_point,
+                                reflection_direction, ray.diff_, ray.time_};
+          reflection_color = RecursiveRayTracingAlgorithm(
+              reflection_ray, inside_object_ptr, remaining_recursion - 1,
+              max_recursion, sample_index, random, nullptr);
+
+          float n1 = inside_object_ptr ? material.refraction_index_ : 1.0f;
+          float n2 = inside_object_ptr ? 1.0 : material.refraction_index_;
+
+          float cos_theta = dot(-ray.direction_, distorted_normal);
+          float cos_phi_2 =
+              1 - (n1 * n1 / (n2 * n2)) * (1 - cos_theta * cos_theta);
+          if (cos_phi_2 > 0.0)
+          {
+            float cos_phi = sqrt(cos_phi_2);
+            float r_p = (n1 * cos_theta - n2 * cos_phi) /
+                        (n1 * cos_theta + n2 * cos_phi);
+            float r_s = (n1 * cos_phi - n2 * cos_theta) /
+                        (n1 * cos_phi + n2 * cos_theta);
+
+            float fresnel_reflection_ratio = (r_p * r_p + r_s * r_s) / 2;
+            float fresnel_transmission_ratio = 1.0 - fresnel_reflection_ratio;
+
+            Vec3f refraction_direction =
+                normalize((n1 / n2) * ray.direction_ +
+                          (n1 / n2 * cos_theta - cos_phi) * distorted_normal);
+            Ray refraction_ray = {
+                ray.pixel_,
+                intersection_point -
+                    2 * shadow_ray_epsilon_ * distorted_normal,
+                refraction_direction, ray.diff_, ray.time_};
+            // If the object type is triangle, inside_object_ptr is nullptr,
+            // check later
+            Vec3f refraction_color = RecursiveRayTracingAlgorithm(
+                refraction_ray, inside_object_ptr ? nullptr : hit_object_ptr,
+                remaining_recursion - 1, max_recursion, sample_index, random,
+                nullptr);
+            pixel_value += reflection_color * fresnel_reflection_ratio;
+            pixel_value += refraction_color * fresnel_transmission_ratio;
+          }
+          else
+          {
+            pixel_value += reflection_color;
+          }
         }
+        break;
+      case MaterialType::kDefault:
+        break;
       }
     }
 
     if (inside_object_ptr)
     {
-      std::shared_ptr<BaseObject> inside_object_casted =
-          std::dynamic_pointer_cast<BaseObject>(inside_object_ptr);
+      const BaseObject *inside_object =
+          static_cast<const BaseObject *>(inside_object_ptr);
 
       Vec3f absorption_coefficient =
-          dynamic_cast<DielectricMaterial *>(
-              (inside_object_casted->material_).get())
-              ->absorption_coefficient_;
+          material_records_[inside_object->material_id_]
+              .absorption_coefficient_;
       pixel_value.x *= exp(-absorption_coefficient.x * t_hit);
       pixel_value.y *= exp(-absorption_coefficient.y * t_hit);
       pixel_value.z *= exp(-absorption_coefficient.z * t_hit);
@@ -0,0 +1,396 @@
+#include <algorithm>
+#include <limits>
+
+#include "Scene.hpp"
+#include "Timer.hpp"
+
+// Hits are sorted by material type and by the octant of the ray direction,
+// so the hits of a type are shaded one after the other and follow the same
+// branches
+static const int kWavefrontSortKeyCount = (int(MaterialType::kMax) + 1) * 8;
+
+static uint8_t WavefrontSortKey(MaterialType type, const Vec3f& direction) {
+  uint8_t octant = (direction.x < 0) | ((direction.y < 0) << 1) |
+                   ((direction.z < 0) << 2);
+  return uint8_t(type) * 8 + octant;
+}
+
+// Two directions perpendicular to normal, built like the recursive algorithm
+// builds them so both draw the same samples
+static void WavefrontBasis(const Vec3f& normal, Vec3f& u, Vec3f& v) {
+  Vec3f normal_prime = normal;
+  int min_index = 0;
+  float min_value = normal.x;
+  if (normal.y < min_value) {
+    min_value = normal.y;
+    min_index = 1;
+  }
+  if (normal.z < min_value) {
+    min_value = normal.z;
+    min_index = 2;
+  }
+  switch (min_index) {
+    case 0:
+      normal_prime.x = 1.0f;
+      break;
+    case 1:
+      normal_prime.y = 1.0f;
+      break;
+    case 2:
+      normal_prime.z = 1.0f;
+      break;
+  }
+  u = normalize(cross(normal_prime, normal));
+  v = cross(normal, u);
+}
+
+void Scene::WavefrontRayTracingAlgorithm(
+    const std::shared_ptr<BaseCamera> camera, int camera_index,
+    const Tile& tile, WavefrontQueues& queues) {
+  bool packet_traversal = configuration_.acceleration_.packet_traversal_ &&
+                          configuration_.acceleration_.bvh_high_level_;
+
+  int tile_width = tile.x_max - tile.x_min;
+  int pixel_count = tile_width * (tile.y_max - tile.y_min);
+  int pixels_per_batch =
+      std::max(kWavefrontBatchSize / int(camera->mem_num_samples_), 1);
+  for (int first_pixel = 0; first_pixel < pixel_count;
+       first_pixel += pixels_per_batch) {
+    int last_pixel = std::min(first_pixel + pixels_per_batch, pixel_count);
+
+    // Camera generation, every sample of the batch starts a path with the
+    // generator the per ray algorithms would give it
+    queues.samples_.clear();
+    queues.paths_.clear();
+    queues.rays_.resize((last_pixel - first_pixel) * camera->mem_num_samples_);
+    int ray_count = 0;
+    for (int pixel = first_pixel; pixel < last_pixel; pixel++) {
+      int x = tile.x_min + pixel % tile_width;
+      int y = tile.y_min + pixel / tile_width;
+      Ray* pixel_rays = queues.rays_.data() + ray_count;
+      int pixel_ray_count = camera->GenerateRays({x, y}, pixel_rays);
+      for (int ray_index = 0; ray_index < pixel_ray_count; ray_index++) {
+        if (timer.configuration_.timer_.ray_tracing_)
+          timer.AddTimeLog(Section::kRayTracing, Event::kStart, camera_index,
+                           y * camera->image_width_ + x, ray_index);
+        WavefrontSample sample = {{x, y},
+                                  ray_index,
+                                  pixel_rays[ray_index].diff_,
+                                  PCG32(pixel_seed({x, y}), ray_index + 1),
+                                  {0, 0, 0}};
+        queues.samples_.push_back(sample);
+        WavefrontPath path = {uint32_t(queues.samples_.size() - 1),
+                              max_recursion_depth_,
+                              {1, 1, 1},
+                              nullptr};
+        queues.paths_.push_back(path);
+      }
+      ray_count += pixel_ray_count;
+    }
+    queues.rays_.resize(ray_count);
+
+    bool primary_wave = true;
+    while (!queues.rays_.empty()) {
+      size_t wave_size = queues.rays_.size();
+      queues.hits_.resize(wave_size);
+      queues.keys_.resize(wave_size);
+      queues.next_rays_.clear();
+      queues.next_paths_.clear();
+      queues.shadow_rays_.clear();
+
+      // Closest hit, the camera rays go through the BVH as packets
+      if (primary_wave && packet_traversal) {
+        IntersectPrimaryRays(queues.rays_.data(), wave_size,
+                             queues.hits_.data());
+      } else {
+        for (size_t i = 0; i < wave_size; i++) {
+          const Ray& ray = queues.rays_[i];
+          HitRecord& hit = queues.hits_[i];
+          const WavefrontPath& path = queues.paths_[i];
+          hit.object_ = nullptr;
+          hit.t_ = std::numeric_limits<float>::max();
+          if (path.inside_object_) {
+            path.inside_object_->Intersect(ray, hit, false);
+            hit.object_ = path.inside_object_;
+            if (dot(ray.direction_, hit.normal_) > 0) {
+              hit.normal_ = -hit.normal_;
+            }
+          } else if (configuration_.acceleration_.bvh_high_level_) {
+            bvh_root_->Intersect(ray, hit);
+          } else {
+            for (const auto& object : objects_) {
+              object->Intersect(ray, hit);
+            }
+          }
+        }
+      }
+      primary_wave = false;
+
+      // Misses end their path here, the others are sorted for shading with a
+      // counting sort over the material type and direction octant
+      uint32_t bucket_start[kWavefrontSortKeyCount + 1] = {0};
+      for (size_t i = 0; i < wave_size; i++) {
+        const WavefrontPath& path = queues.paths_[i];
+        const HitRecord& hit = queues.hits_[i];
+        if (!hit.object_) {
+          if (path.remaining_recursion_ == max_recursion_depth_) {
+            Vec3f background = {float(background_color_.x),
+                                float(background_color_.y),
+                                float(background_color_.z)};
+            queues.samples_[path.sample_].value_ +=
+                hadamard(background, path.throughput_);
+          }
+          continue;
+        }
+        const BaseObject* object = static_cast<const BaseObject*>(hit.object_);
+        queues.keys_[i] =
+            WavefrontSortKey(material_records_[object->material_id_].type_,
+                             queues.rays_[i].direction_);
+        bucket_start[queues.keys_[i] + 1]++;
+      }
+      for (int key = 0; key < kWavefrontSortKeyCount; key++) {
+        bucket_start[key + 1] += bucket_start[key];
+      }
+      queues.order_.resize(bucket_start[kWavefrontSortKeyCount]);
+      for (size_t i = 0; i < wave_size; i++) {
+        if (queues.hits_[i].object_) {
+          queues.order_[bucket_start[queues.keys_[i]]++] = i;
+        }
+      }
+
+      // Shading, adds the ambient term, queues a shadow ray per light and the
+      // secondary rays of the next wave. Every vertex draws from the generator
+      // of its sample in the order the recursive algorithm draws.
+      for (uint32_t i : queues.order_) {
+        const Ray& ray = queues.rays_[i];
+        const HitRecord& hit = queues.hits_[i];
+        const WavefrontPath& path = queues.paths_[i];
+        WavefrontSample& sample = queues.samples_[path.sample_];
+        const BaseObject* object = static_cast<const BaseObject*>(hit.object_);
+        const MaterialRecord& material =
+            material_records_[object->material_id_];
+        Vec3f throughput = path.throughput_;
+
+        // Absorption along the segment inside a dielectric scales everything
+        // found beyond it
+        if (path.inside_object_) {
+          const BaseObject* inside_object =
+              static_cast<const BaseObject*>(path.inside_object_);
+          Vec3f absorption_coefficient =
+              material_records_[inside_object->material_id_]
+                  .absorption_coefficient_;
+          throughput.x *= exp(-absorption_coefficient.x * hit.t_);
+          throughput.y *= exp(-absorption_coefficient.y * hit.t_);
+          throughput.z *= exp(-absorption_coefficient.z * hit.t_);
+        }
+
+        Vec3f intersection_point = ray.origin_ + ray.direction_ * hit.t_ +
+                                   hit.normal_ * shadow_ray_epsilon_;
+
+        if (!path.inside_object_) {
+          if (configuration_.shading_.ambient_) {
+            for (auto ambient_light : ambient_lights_) {
+              sample.value_ += hadamard(
+                  hadamard(material.ambient_, ambient_light->intensity_),
+                  throughput);
+            }
+          }
+
+          // Radiance a light adds when it is not occluded, lights that add
+          // nothing get no shadow ray
+          auto queue_shadow_ray = [&](const Vec3f& light_position,
+                                      const Vec3f& light_radiance) {
+            Vec3f light_direction =
+                normalize(light_position - intersection_point);
+            Vec3f radiance = {0, 0, 0};
+            if (configuration_.shading_.diffuse_) {
+              radiance += hadamard(material.diffuse_, light_radiance) *
+                          std::max(0.0f, dot(hit.normal_, light_direction));
+            }
+            if (configuration_.shading_.specular_ &&
+                material.phong_exponent_ >= 0.0f) {
+              Vec3f half_vector = normalize(light_direction - ray.direction_);
+              radiance += hadamard(material.specular_, light_radiance) *
+                          pow(std::max(0.0f, dot(hit.normal_, half_vector)),
+                              material.phong_exponent_);
+            }
+            if (radiance.x == 0 && radiance.y == 0 && radiance.z == 0) {
+              return;
+            }
+            WavefrontShadowRay shadow_ray = {
+                Ray(ray.pixel_, intersection_point, light_direction, ray.diff_,
+                    ray.time_),
+                float(sqrt(norm2(light_position - intersection_point))),
+                path.sample_, hadamard(radiance, throughput)};
+            queues.shadow_rays_.push_back(shadow_ray);
+          };
+
+          for (auto point_light : point_lights_) {
+            float distance_to_light =
+                norm2(point_light->position_ - intersection_point);
+            queue_shadow_ray(point_light->position_,
+                             point_light->intensity_ / distance_to_light);
+          }
+
+          // The samples of a pixel are stratified over each light, every
+          // bounce scrambles them differently
+          const uint64_t shading_seed =
+              pixel_seed(sample.pixel_) ^
+              (uint64_t(path.remaining_recursion_) << 32);
+          for (size_t light_index = 0; light_index < area_lights_.size();
+               light_index++) {
+            const auto& area_light = area_lights_[light_index];
+            Vec2f diff = area_light_sampler_.Get2D(sample.ray_index_,
+                                                   shading_seed ^ light_index);
+            Vec3f area_light_normal = -normalize(area_light->normal_);
+            Vec3f u, v;
+            WavefrontBasis(area_light_normal, u, v);
+            Vec3f area_light_position =
+                area_light->position_ +
+                area_light->size_ * (u * (2.0 * diff.x - 1.0f) +
+                                     v * (2.0 * diff.y - 1.0f));
+            Vec3f light_direction =
+                normalize(area_light_position - intersection_point);
+            float distance_to_light =
+                norm2(area_light_position - intersection_point);
+            float irradiance_coeff =
+                abs(area_light->size_ * area_light->size_ *
+                    dot(area_light_normal, light_direction) /
+                    distance_to_light);
+            queue_shadow_ray(area_light_position,
+                             area_light->radiance_ * irradiance_coeff);
+          }
+        }
+
+        if (path.remaining_recursion_ == 0) {
+          continue;
+        }
+
+        // Secondary bounces, each becomes a path of the next wave weighted by
+        // the factor the recursive algorithm multiplies its color with
+        Vec3f distorted_normal = hit.normal_;
+        if (material.roughness_ > 0.0f) {
+          Vec3f u, v;
+          WavefrontBasis(hit.normal_, u, v);
+          distorted_normal = normalize(
+              hit.normal_ + material.roughness_ *
+                                (u * (sample.random_.NextFloat() - 0.5f) +
+                                 v * (sample.random_.NextFloat() - 0.5f)));
+        }
+        Vec3f reflection_direction =
+            ray.direction_ -
+            2 * dot(ray.direction_, distorted_normal) * distorted_normal;
+        auto queue_secondary_ray =
+            [&](const Vec3f& origin, const Vec3f& direction,
+                const Vec3f& weight,
+                const BoundingVolumeHierarchyElement* inside_object) {
+              queues.next_rays_.push_back(
+                  Ray(ray.pixel_, origin, direction, ray.diff_, ray.time_));
+              WavefrontPath next_path = {path.sample_,
+                                         path.remaining_recursion_ - 1,
+                                         hadamard(throughput, weight),
+                                         inside_object};
+              queues.next_paths_.push_back(next_path);
+            };
+
+        switch (material.type_) {
+          case MaterialType::kMirror:
+            if (configuration_.materials_.mirror_) {
+              queue_secondary_ray(intersection_point, reflection_direction,
+                                  material.mirror_, path.inside_object_);
+            }
+            break;
+          case MaterialType::kConductor:
+            if (configuration_.materials_.conductor_) {
+              float n2 = material.refraction_index_;
+              float k2 = material.absorption_index_;
+              float cos_theta = -dot(ray.direction_, distorted_normal);
+              float n2_k2_2 = n2 * n2 + k2 * k2;
+              float n2_cos_theta_tw = 2 * n2 * cos_theta;
+              float cos_theta_2 = cos_theta * cos_theta;
+              float rs = (n2_k2_2 - n2_cos_theta_tw + cos_theta_2) /
+                         (n2_k2_2 + n2_cos_theta_tw + cos_theta_2);
+              float rp = (n2_k2_2 * cos_theta_2 - n2_cos_theta_tw + 1) /
+                         (n2_k2_2 * cos_theta_2 + n2_cos_theta_tw + 1);
+              float fresnel_reflection_ratio = (rs + rp) / 2;
+              queue_secondary_ray(intersection_point, reflection_direction,
+                                  material.mirror_ * fresnel_reflection_ratio,
+                                  path.inside_object_);
+            }
+            break;
+          case MaterialType::kDielectric:
+            if (configuration_.materials_.dielectric_) {
+              float n1 =
+                  path.inside_object_ ? material.refraction_index_ : 1.0f;
+              float n2 = path.inside_object_ ? 1.0 : material.refraction_index_;
+
+              float cos_theta = dot(-ray.direction_, distorted_normal);
+              float cos_phi_2 =
+                  1 - (n1 * n1 / (n2 * n2)) * (1 - cos_theta * cos_theta);
+              if (cos_phi_2 > 0.0) {
+                float cos_phi = sqrt(cos_phi_2);
+                float r_p = (n1 * cos_theta - n2 * cos_phi) /
+                            (n1 * cos_theta + n2 * cos_phi);
+                float r_s = (n1 * cos_phi - n2 * cos_theta) /
+                            (n1 * cos_phi + n2 * cos_theta);
+                float fresnel_reflection_ratio = (r_p * r_p + r_s * r_s) / 2;
+                float fresnel_transmission_ratio =
+                    1.0 - fresnel_reflection_ratio;
+
+                Vec3f refraction_direction = normalize(
+                    (n1 / n2) * ray.direction_ +
+                    (n1 / n2 * cos_theta - cos_phi) * distorted_normal);
+                queue_secondary_ray(intersection_point, reflection_direction,
+                                    Vec3f{1, 1, 1} * fresnel_reflection_ratio,
+                                    path.inside_object_);
+                queue_secondary_ray(
+                    intersection_point -
+                        2 * shadow_ray_epsilon_ * distorted_normal,
+                    refraction_direction,
+                    Vec3f{1, 1, 1} * fresnel_transmission_ratio,
+                    path.inside_object_ ? nullptr : hit.object_);
+              } else {
+                queue_secondary_ray(intersection_point, reflection_direction,
+                                    {1, 1, 1}, path.inside_object_);
+              }
+            }
+            break;
+          case MaterialType::kDefault:
+            break;
+        }
+      }
+
+      // Shadow rays, only the occlusion is needed so they stop at any hit
+      for (WavefrontShadowRay& shadow_ray : queues.shadow_rays_) {
+        bool is_in_shadow = false;
+        if (configuration_.acceleration_.bvh_high_level_) {
+          is_in_shadow =
+              bvh_root_->Occluded(shadow_ray.ray_, shadow_ray.t_max_);
+        } else {
+          for (auto object : objects_) {
+            if (object->Occluded(shadow_ray.ray_, shadow_ray.t_max_)) {
+              is_in_shadow = true;
+              break;
+            }
+          }
+        }
+        if (!is_in_shadow) {
+          queues.samples_[shadow_ray.sample_].value_ += shadow_ray.radiance_;
+        }
+      }
+
+      std::swap(queues.rays_, queues.next_rays_);
+      std::swap(queues.paths_, queues.next_paths_);
+    }
+
+    for (const WavefrontSample& sample : queues.samples_) {
+      camera->UpdateSampledPixelValue(sample.pixel_, sample.value_,
+                                      sample.ray_index_, sample.diff_);
+      if (timer.configuration_.timer_.ray_tracing_)
+        timer.AddTimeLog(
+            Section::kRayTracing, Event::kEnd, camera_index,
+            sample.pixel_.y * camera->image_width_ + sample.pixel_.x,
+            sample.ray_index_);
+    }
+  }
+}
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "Sampler.hpp"
+
+#include "Helper.hpp"
+#include "Random.hpp"
+
+static uint32_t reverse_bits(uint32_t value) {
+  value = (value << 16) | (value >> 16);
+  value = ((value & 0x00ff00ff) << 8) | ((value & 0xff00ff00) >> 8);
+  value = ((value & 0x0f0f0f0f) << 4) | ((value & 0xf0f0f0f0) >> 4);
+  value = ((value & 0x33333333) << 2) | ((value & 0xcccccccc) >> 2);
+  value = ((value & 0x55555555) << 1) | ((value & 0xaaaaaaaa) >> 1);
+  return value;
+}
+
+// First two dimensions of the Sobol sequence. The first one is the van der
+// Corput sequence, the direction numbers of the second one follow
+// v_i = v_(i-1) ^ (v_(i-1) >> 1).
+static void sobol_2d(uint32_t index, uint32_t& x, uint32_t& y) {
+  x = reverse_bits(index);
+  y = 0;
+  for (uint32_t direction = 1u << 31; index; index >>= 1) {
+    if (index & 1) {
+      y ^= direction;
+    }
+    direction ^= direction >> 1;
+  }
+}
+
+// Hash of Laine and Karras, every bit only depends on the bits below it
+static uint32_t laine_karras_permutation(uint32_t value, uint32_t seed) {
+  value += seed;
+  value ^= value * 0x6c50b47c;
+  value ^= value * 0xb82f1e52;
+  value ^= value * 0xc7afe638;
+  value ^= value * 0x8d22f6e6;
+  return value;
+}
+
+// Owen scrambling, flipping the bits below every node of the binary interval
+// tree with a hash of the bits above it (Burley 2020)
+static uint32_t nested_uniform_scramble(uint32_t value, uint32_t seed) {
+  return reverse_bits(laine_karras_permutation(reverse_bits(value), seed));
+}
+
+static uint32_t to_fixed_point(float sample) {
+  return uint32_t(std::min(std::max(double(sample), 0.0), 1.0 - 1e-9) *
+                  4294967296.0);
+}
+
+Sampler::Sampler(const SamplingAlgorithm sampling_algorithm,
+                 const int sample_count, const int dimension_count)
+    : sample_count_(std::max(sample_count, 1)),
+      sampling_algorithm_(sampling_algorithm) {
+  x_.resize(sample_count_);
+  y_.resize(sample_count_);
+
+  if (sampling_algorithm_ == SamplingAlgorithm::kSobol ||
+      sampling_algorithm_ == SamplingAlgorithm::kOwenSobol) {
+    for (int i = 0; i < sample_count_; i++) {
+      sobol_2d(i, x_[i], y_[i]);
+    }
+    return;
+  }
+
+  PCG32 random(mix_bits(sample_count_));
+
+  std::vector<float> samples_1d;
+  std::vector<Vec2f> samples_2d;
+  if (dimension_count == 1 &&
+      sampling_algorithm_ == SamplingAlgorithm::kUniform) {
+    samples_1d = uniform_1d(sample_count_, random);
+  } else if (dimension_count == 1 &&
+             sampling_algorithm_ == SamplingAlgorithm::kRandom) {
+    samples_1d = uniform_random_1d(sample_count_, random);
+  } else if (dimension_count == 1 &&
+             sampling_algorithm_ == SamplingAlgorithm::kJittered) {
+    samples_1d = jittered_1d(sample_count_, random);
+  } else {
+    switch (sampling_algorithm_) {
+      case SamplingAlgorithm::kUniform:
+        samples_2d = uniform_2d(sample_count_, random);
+        break;
+      case SamplingAlgorithm::kRandom:
+        samples_2d = uniform_random_2d(sample_count_, random);
+        break;
+      case SamplingAlgorithm::kJittered:
+        samples_2d = jittered_2d(sample_count_, random);
+        break;
+      case SamplingAlgorithm::kMultiJittered:
+        samples_2d = multi_jittered_2d(sample_count_, random);
+        break;
+      case SamplingAlgorithm::kHalton:
+        samples_2d = halton_2d(sample_count_, random);
+        break;
+      case SamplingAlgorithm::kHammersley:
+        samples_2d = hammersley_2d(sample_count_, random);
+        break;
+      default:
+        // The Sobol samplers are tabulated above
+        break;
+    }
+  }
+
+  // Some samplers return more or fewer samples than asked for, their
+  // patterns are cut or repeated to the sample count
+  for (int i = 0; i < sample_count_; i++) {
+    if (!samples_1d.empty()) {
+      x_[i] = to_fixed_point(samples_1d[i % samples_1d.size()]);
+    } else if (!samples_2d.empty()) {
+      x_[i] = to_fixed_point(samples_2d[i % samples_2d.size()].x);
+      y_[i] = to_fixed_point(samples_2d[i % samples_2d.size()].y);
+    }
+  }
+}
+
+uint32_t Sampler::Scramble(uint32_t value, uint32_t scramble) const {
+  switch (sampling_algorithm_) {
+    case SamplingAlgorithm::kSobol:
+      return value ^ scramble;
+    case SamplingAlgorithm::kOwenSobol:
+      return nested_uniform_scramble(value, scramble);
+    default:
+      return value + scramble;
+  }
+}
+
+// The seed also rotates the sample order, so that the samples of different
+// dimensions are paired differently in every pixel
+float Sampler::Get1D(int sample_index, uint64_t seed) const {
+  uint64_t hash = mix_bits(seed);
+  int index = (sample_index + (hash >> 32) % sample_count_) % sample_count_;
+  return unit_float(Scramble(x_[index], uint32_t(hash)));
+}
+
+Vec2f Sampler::Get2D(int sample_index, uint64_t seed) const {
+  uint64_t hash = mix_bits(seed);
+  int index = (sample_index + (hash >> 32) % sample_count_) % sample_count_;
+  return Vec2f{unit_float(Scramble(x_[index], uint32_t(hash))),
+               unit_float(Scramble(y_[index], uint32_t(mix_bits(hash))))};
+}
\ No newline at end of file
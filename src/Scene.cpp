@@ -4,6 +4,10 @@
 
 Scene::Scene(const std::string &filename, const Configuration &configuration)
     : filename_(filename), configuration_(configuration) {
+  thread_pool_ = std::make_shared<ThreadPool>(
+      configuration_.strategies_.thread_count_,
+      configuration_.strategies_.thread_affinity_);
+
   switch (configuration_.strategies_.exporter_type_) {
     case ExporterType::kPPM:
       exporter_ = std::make_shared<PPMExporter>();
@@ -17,12 +21,20 @@ Scene::Scene(const std::string &filename, const Configuration &configuration)
     case RayTracingAlgorithm::kDefault:
       ray_tracing_algorithm_ = std::bind(
           &Scene::DefaultRayTracingAlgorithm, this, std::placeholders::_1,
-          std::placeholders::_2, std::placeholders::_3, std::placeholders::_4);
+          std::placeholders::_2, std::placeholders::_3, std::placeholders::_4,
+          std::placeholders::_5, std::placeholders::_6,
+          std::placeholders::_7);
       break;
     case RayTracingAlgorithm::kRecursive:
       ray_tracing_algorithm_ = std::bind(
           &Scene::RecursiveRayTracingAlgorithm, this, std::placeholders::_1,
-          std::placeholders::_2, std::placeholders::_3, std::placeholders::_4);
+          std::placeholders::_2, std::placeholders::_3, std::placeholders::_4,
+          std::placeholders::_5, std::placeholders::_6,
+          std::placeholders::_7);
+      break;
+    case RayTracingAlgorithm::kWavefront:
+      // Traces whole tiles, the schedulers call WavefrontRayTracingAlgorithm
+      // instead of a per ray algorithm
       break;
   }
 
@@ -37,11 +49,10 @@ Scene::Scene(const std::string &filename, const Configuration &configuration)
           std::bind(&Scene::ThreadQueueSchedulingAlgorithm, this,
                     std::placeholders::_1, std::placeholders::_2);
       break;
-  }
-
-  switch (configuration_.sampling_.area_light_sampling_) {
-    case SamplingAlgorithm::kRandom:
-      area_light_sampling_algorithm_ = uniform_random_2d;
+    case SchedulingAlgorithm::kWorkStealing:
+      scheduling_algorithm_ =
+          std::bind(&Scene::WorkStealingSchedulingAlgorithm, this,
+                    std::placeholders::_1, std::placeholders::_2);
       break;
   }
 
@@ -162,34 +173,38 @@ void Scene::LoadScene() {
   std::cout << "\tLoading materials." << std::endl;
 #endif
   for (const auto &raw_material : raw_scene.materials) {
+    int material_id = materials_.size();
     switch (raw_material.material_type) {
       case RawMaterialType::kDefault:
         materials_.push_back(std::make_shared<BaseMaterial>(
-            raw_material.ambient, raw_material.diffuse, raw_material.specular,
-            raw_material.phong_exponent, raw_material.roughness));
+            material_id, raw_material.ambient, raw_material.diffuse,
+            raw_material.specular, raw_material.phong_exponent,
+            raw_material.roughness));
         break;
 
       case RawMaterialType::kMirror:
         materials_.push_back(std::make_shared<MirrorMaterial>(
-            raw_material.ambient, raw_material.diffuse, raw_material.specular,
-            raw_material.phong_exponent, raw_material.roughness,
-            raw_material.mirror));
+            material_id, raw_material.ambient, raw_material.diffuse,
+            raw_material.specular, raw_material.phong_exponent,
+            raw_material.roughness, raw_material.mirror));
         break;
       case RawMaterialType::kConductor:
         materials_.push_back(std::make_shared<ConductorMaterial>(
-            raw_material.ambient, raw_material.diffuse, raw_material.specular,
-            raw_material.phong_exponent, raw_material.roughness,
-            raw_material.mirror, raw_material.refraction_index,
-            raw_material.absorption_index));
+            material_id, raw_material.ambient, raw_material.diffuse,
+            raw_material.specular, raw_material.phong_exponent,
+            raw_material.roughness, raw_material.mirror,
+            raw_material.refraction_index, raw_material.absorption_index));
         break;
       case RawMaterialType::kDielectric:
         materials_.push_back(std::make_shared<DielectricMaterial>(
-            raw_material.ambient, raw_material.diffuse, raw_material.specular,
-            raw_material.phong_exponent, raw_material.roughness,
-            raw_material.mirror, raw_material.absorption_coefficient,
+            material_id, raw_material.ambient, raw_material.diffuse,
+            raw_material.specular, raw_material.phong_exponent,
+            raw_material.roughness, raw_material.mirror,
+            raw_material.absorption_coefficient,
             raw_material.refraction_index));
         break;
     }
+    material_records_.push_back(materials_.back()->Record());
   }
 
 #ifdef DEBUG
@@ -253,14 +268,21 @@ void Scene::LoadScene() {
           std::dynamic_pointer_cast<BoundingVolumeHierarchyElement>(
               std::make_shared<MeshObject>(
                   materials_[raw_mesh.material_id - 1], raw_mesh.ply_filepath,
-                  raw_mesh.motion_blur, transform_matrix, scaling_flip)));
+                  raw_mesh.motion_blur, transform_matrix, scaling_flip,
+                  configuration_.acceleration_.bvh_construction_algorithm_,
+                  configuration_.acceleration_.bvh_layout_,
+                  configuration_.acceleration_.bvh_low_level_
+                      ? configuration_.acceleration_.bvh_cache_directory_
+                      : "")));
     } else {
       objects_.push_back(
           std::dynamic_pointer_cast<BoundingVolumeHierarchyElement>(
               std::make_shared<MeshObject>(
                   materials_[raw_mesh.material_id - 1], raw_mesh.faces,
                   raw_scene.vertex_data, raw_mesh.motion_blur, transform_matrix,
-                  scaling_flip)));
+                  scaling_flip,
+                  configuration_.acceleration_.bvh_construction_algorithm_,
+                  configuration_.acceleration_.bvh_layout_)));
     }
   }
   // exit(1);
@@ -363,29 +385,85 @@ void Scene::LoadScene() {
 }
 
 void Scene::PreprocessScene() {
-#ifdef DEBUG
-  int object_index = 0;
-#endif
-
+  // Meshes large enough for a parallel BVH build get the whole pool one after
+  // the other, the other objects are preprocessed side by side with a task
+  // each. Instances are bounded by the BVH of their mesh, so they come last.
+  std::vector<std::shared_ptr<BaseObject>> large_meshes;
+  std::vector<std::shared_ptr<BaseObject>> small_objects;
+  std::vector<std::shared_ptr<BaseObject>> mesh_instances;
   for (const auto &object : objects_) {
-#ifdef DEBUG
-    std::cout << "\tPreprocessing for object : " << object_index << std::endl;
-#endif
     std::shared_ptr<BaseObject> object_casted =
         std::dynamic_pointer_cast<BaseObject>(object);
+    std::shared_ptr<MeshObject> mesh_object =
+        std::dynamic_pointer_cast<MeshObject>(object);
+    if (std::dynamic_pointer_cast<MeshInstanceObject>(object)) {
+      mesh_instances.push_back(object_casted);
+    } else if (mesh_object &&
+               mesh_object->TriangleCount() >= kParallelBuildMinPrimitives) {
+      large_meshes.push_back(object_casted);
+    } else {
+      small_objects.push_back(object_casted);
+    }
+  }
+#ifdef DEBUG
+  std::cout << "\tPreprocessing " << large_meshes.size() << " large meshes, "
+            << small_objects.size() << " other objects and "
+            << mesh_instances.size() << " mesh instances." << std::endl;
+#endif
 
-    object_casted->Preprocess(configuration_.acceleration_.bvh_high_level_,
-                              configuration_.acceleration_.bvh_low_level_);
+  bool high_level_bvh_enabled = configuration_.acceleration_.bvh_high_level_;
+  bool low_level_bvh_enabled = configuration_.acceleration_.bvh_low_level_;
+  for (const auto &mesh_object : large_meshes) {
+    mesh_object->Preprocess(high_level_bvh_enabled, low_level_bvh_enabled,
+                            true, thread_pool_.get());
   }
+  thread_pool_->ParallelFor(0, small_objects.size(), 1, [&](int i) {
+    small_objects[i]->Preprocess(high_level_bvh_enabled,
+                                 low_level_bvh_enabled);
+  });
+  thread_pool_->ParallelFor(0, mesh_instances.size(), 64, [&](int i) {
+    mesh_instances[i]->Preprocess(high_level_bvh_enabled,
+                                  low_level_bvh_enabled);
+  });
 
   if (configuration_.acceleration_.bvh_high_level_) {
-    bvh_root_ = BoundingVolumeHierarchyElement::Construct(objects_, 0,
-                                                          objects_.size(), 0);
+    bvh_root_ = std::make_shared<BoundingVolumeHierarchy>(
+        objects_, configuration_.acceleration_.bvh_construction_algorithm_,
+        configuration_.acceleration_.bvh_layout_, thread_pool_.get());
+  }
+}
+
+void Scene::IntersectPrimaryRays(const Ray *rays, int ray_count,
+                                 HitRecord *hits) {
+  for (int first = 0; first < ray_count; first += kRayPacketWidth) {
+    RayPacket packet;
+    packet.Load(rays + first, std::min(kRayPacketWidth, ray_count - first));
+    HitRecord *packet_hits = hits + first;
+    for (int lane = 0; lane < packet.ray_count_; lane++) {
+      packet_hits[lane].object_ = nullptr;
+    }
+
+    // Samples of a pixel nearly always share their direction signs, the
+    // rare packets that do not are traced one ray at a time
+    if (packet.coherent_) {
+      bvh_root_->IntersectPacket(packet, packet.ActiveMask(), packet_hits);
+    } else {
+      for (int lane = 0; lane < packet.ray_count_; lane++) {
+        packet_hits[lane].t_ = packet.t_closest_[lane];
+        bvh_root_->Intersect(rays[first + lane], packet_hits[lane]);
+        packet.t_closest_[lane] = packet_hits[lane].t_;
+      }
+    }
+
+    for (int lane = 0; lane < packet.ray_count_; lane++) {
+      packet_hits[lane].t_ = packet.t_closest_[lane];
+    }
   }
 }
 
 void Scene::Render() {
   int camera_index = 0;
+  TaskGroup export_tasks;
   for (const auto &camera : cameras_) {
     if (timer.configuration_.timer_.render_scene_ ||
         timer.configuration_.timer_.ray_tracing_ ||
@@ -393,6 +471,10 @@ void Scene::Render() {
         timer.configuration_.timer_.export_image_)
       timer.AddTimeLog(Section::kRenderScene, Event::kStart, camera_index);
 
+    area_light_sampler_ =
+        Sampler(configuration_.sampling_.area_light_sampling_,
+                camera->mem_num_samples_, 2);
+
 #ifdef DEBUG
     std::cout << "Rendering camera " << camera_index << std::endl;
 #endif
@@ -420,16 +502,20 @@ void Scene::Render() {
 #ifdef DEBUG
     std::cout << "Exporting result " << camera_index << std::endl;
 #endif
-    if (timer.configuration_.timer_.export_image_)
-      timer.AddTimeLog(Section::kExportImage, Event::kStart, camera_index);
-    camera->ExportView(exporter_);
-    if (timer.configuration_.timer_.export_image_)
-      timer.AddTimeLog(Section::kExportImage, Event::kEnd, camera_index);
-    if (timer.configuration_.timer_.render_scene_ ||
-        timer.configuration_.timer_.ray_tracing_ ||
-        timer.configuration_.timer_.tone_mapping_ ||
-        timer.configuration_.timer_.export_image_)
-      timer.AddTimeLog(Section::kRenderScene, Event::kEnd, camera_index);
+    // The image is written by a pool thread while the next camera renders
+    thread_pool_->Submit(export_tasks, [this, camera, camera_index]() {
+      if (timer.configuration_.timer_.export_image_)
+        timer.AddTimeLog(Section::kExportImage, Event::kStart, camera_index);
+      camera->ExportView(exporter_);
+      if (timer.configuration_.timer_.export_image_)
+        timer.AddTimeLog(Section::kExportImage, Event::kEnd, camera_index);
+      if (timer.configuration_.timer_.render_scene_ ||
+          timer.configuration_.timer_.ray_tracing_ ||
+          timer.configuration_.timer_.tone_mapping_ ||
+          timer.configuration_.timer_.export_image_)
+        timer.AddTimeLog(Section::kRenderScene, Event::kEnd, camera_index);
+    });
     camera_index++;
   }
+  thread_pool_->Wait(export_tasks);
 }
\ No newline at end of file
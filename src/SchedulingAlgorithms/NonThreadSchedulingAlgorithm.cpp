@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "Scene.hpp"
 #include "Timer.hpp"
 
@@ -7,13 +9,36 @@ void Scene::NonThreadSchedulingAlgorithm(
   std::cout << "Camera resolution " << camera->image_height_ << "x"
             << camera->image_width_ << std::endl;
 #endif
+  if (configuration_.strategies_.ray_tracing_algorithm_ ==
+      RayTracingAlgorithm::kWavefront) {
+    // A wave holds all the samples of a tile, tiles are taken in scanline
+    // order
+    int tile_size = std::max(configuration_.strategies_.tile_size_, 1);
+    WavefrontQueues queues;
+    for (int y = 0; y < camera->image_height_; y += tile_size) {
+      for (int x = 0; x < camera->image_width_; x += tile_size) {
+        Tile tile = {x, y, std::min(x + tile_size, camera->image_width_),
+                     std::min(y + tile_size, camera->image_height_)};
+        WavefrontRayTracingAlgorithm(camera, camera_index, tile, queues);
+      }
+    }
+    return;
+  }
+
+  bool packet_traversal = configuration_.acceleration_.packet_traversal_ &&
+                          configuration_.acceleration_.bvh_high_level_;
+  std::vector<Ray> rays(camera->mem_num_samples_);
+  std::vector<HitRecord> hits(camera->mem_num_samples_);
   for (int y = 0; y < camera->image_height_; ++y) {
     for (int x = 0; x < camera->image_width_; ++x) {
 #ifdef DEBUG
       std::cout << "Tracing ray for index " << x << "," << y << std::endl;
 #endif
 
-      std::vector<Ray> rays = camera->GenerateRay({x, y});
+      int ray_count = camera->GenerateRays({x, y}, rays.data());
+      if (packet_traversal) {
+        IntersectPrimaryRays(rays.data(), ray_count, hits.data());
+      }
 #ifdef DEBUG
       std::cout << "Generated ray is " << "[" << ray.origin_.x << ray.origin_.y
                 << ray.origin_.z << "]"
@@ -22,13 +47,15 @@ void Scene::NonThreadSchedulingAlgorithm(
                 << ray.direction_.x << ray.direction_.y << ray.direction_.z
                 << "]" << std::endl;
 #endif
-      for (int ray_index = 0; ray_index < rays.size(); ray_index++) {
+      for (int ray_index = 0; ray_index < ray_count; ray_index++) {
         if (timer.configuration_.timer_.ray_tracing_)
           timer.AddTimeLog(Section::kRayTracing, Event::kStart, camera_index,
                            y * camera->image_width_ + x, ray_index);
-        const Vec3f pixel_value =
-            ray_tracing_algorithm_(rays[ray_index], nullptr,
-                                   max_recursion_depth_, max_recursion_depth_);
+        PCG32 random(pixel_seed({x, y}), ray_index + 1);
+        const Vec3f pixel_value = ray_tracing_algorithm_(
+            rays[ray_index], nullptr, max_recursion_depth_,
+            max_recursion_depth_, ray_index, random,
+            packet_traversal ? &hits[ray_index] : nullptr);
 #ifdef DEBUG
         std::cout << "Pixel value is " << "(" << pixel_value.x << pixel_value.y
                   << pixel_value.z << ")" << std::endl;
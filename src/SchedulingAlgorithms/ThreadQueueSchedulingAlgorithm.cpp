@@ -1,6 +1,5 @@
 #include <mutex>
 #include <queue>
-#include <thread>
 
 #include "Scene.hpp"
 #include "Timer.hpp"
@@ -15,13 +14,17 @@ void Scene::ThreadQueueSchedulingAlgorithm(
     }
   }
 
-  auto processor_count = std::thread::hardware_concurrency();
-  processor_count = processor_count > 0 ? processor_count : 8;
+  bool packet_traversal = configuration_.acceleration_.packet_traversal_ &&
+                          configuration_.acceleration_.bvh_high_level_;
+  bool wavefront = configuration_.strategies_.ray_tracing_algorithm_ ==
+                   RayTracingAlgorithm::kWavefront;
 
-  std::vector<std::thread> threads;
-
-  for (size_t i = 0; i < processor_count; i++) {
-    threads.emplace_back([&]() {
+  TaskGroup workers;
+  for (size_t i = 0; i < thread_pool_->Size(); i++) {
+    thread_pool_->Submit(workers, [&]() {
+      std::vector<Ray> rays(camera->mem_num_samples_);
+      std::vector<HitRecord> hits(camera->mem_num_samples_);
+      WavefrontQueues queues;
       while (true) {
         std::pair<int, int> index;
         {
@@ -33,16 +36,30 @@ void Scene::ThreadQueueSchedulingAlgorithm(
           queue.pop();
         }
 
-        std::vector<Ray> rays =
-            camera->GenerateRay({index.first, index.second});
-        for (int ray_index = 0; ray_index < rays.size(); ray_index++) {
+        if (wavefront) {
+          Tile tile = {index.first, index.second, index.first + 1,
+                       index.second + 1};
+          WavefrontRayTracingAlgorithm(camera, camera_index, tile, queues);
+          continue;
+        }
+
+        int ray_count =
+            camera->GenerateRays({index.first, index.second}, rays.data());
+        if (packet_traversal) {
+          IntersectPrimaryRays(rays.data(), ray_count, hits.data());
+        }
+        for (int ray_index = 0; ray_index < ray_count; ray_index++) {
           if (timer.configuration_.timer_.ray_tracing_)
             timer.AddTimeLog(Section::kRayTracing, Event::kStart, camera_index,
                              index.second * camera->image_width_ + index.first,
                              ray_index);
+          // Every sample has its own stream, so the path it traces does not
+          // depend on the other samples or on the thread tracing it
+          PCG32 random(pixel_seed({index.first, index.second}), ray_index + 1);
           const Vec3f pixel_value = ray_tracing_algorithm_(
               rays[ray_index], nullptr, max_recursion_depth_,
-              max_recursion_depth_);
+              max_recursion_depth_, ray_index, random,
+              packet_traversal ? &hits[ray_index] : nullptr);
           camera->UpdateSampledPixelValue({index.first, index.second},
                                           pixel_value, ray_index,
                                           rays[ray_index].diff_);
@@ -71,7 +88,5 @@ void Scene::ThreadQueueSchedulingAlgorithm(
 
   // status_thread.join();
 
-  for (auto& thread : threads) {
-    thread.join();
-  }
+  thread_pool_->Wait(workers);
 }
\ No newline at end of file
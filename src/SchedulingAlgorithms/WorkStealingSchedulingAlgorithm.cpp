@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <deque>
+#include <mutex>
+
+#include "Scene.hpp"
+#include "Timer.hpp"
+
+// Each worker owns a deque, it takes tiles from the front of its own one and
+// steals from the back of the others once it runs dry
+struct TileDeque {
+  std::deque<Tile> tiles_;
+  std::mutex mutex_;
+};
+
+static uint32_t MortonCode(uint32_t x, uint32_t y) {
+  uint32_t code = 0;
+  for (int bit = 0; bit < 16; bit++) {
+    code |= ((x >> bit) & 1) << (2 * bit);
+    code |= ((y >> bit) & 1) << (2 * bit + 1);
+  }
+  return code;
+}
+
+// Returns the tile grid coordinates in the order they should be rendered
+static std::vector<Vec2i> OrderTiles(int tile_count_x, int tile_count_y,
+                                     TileOrdering tile_ordering) {
+  std::vector<Vec2i> tile_coordinates;
+  tile_coordinates.reserve(tile_count_x * tile_count_y);
+
+  switch (tile_ordering) {
+    case TileOrdering::kScanline:
+      for (int y = 0; y < tile_count_y; y++) {
+        for (int x = 0; x < tile_count_x; x++) {
+          tile_coordinates.push_back({x, y});
+        }
+      }
+      break;
+    case TileOrdering::kMorton:
+      for (int y = 0; y < tile_count_y; y++) {
+        for (int x = 0; x < tile_count_x; x++) {
+          tile_coordinates.push_back({x, y});
+        }
+      }
+      std::sort(tile_coordinates.begin(), tile_coordinates.end(),
+                [](const Vec2i& a, const Vec2i& b) {
+                  return MortonCode(a.x, a.y) < MortonCode(b.x, b.y);
+                });
+      break;
+    case TileOrdering::kSpiral: {
+      // Walk a square spiral out of the center tile, with legs of length
+      // 1, 1, 2, 2, 3, 3, ... and skip the steps outside of the image
+      const int direction_x[4] = {1, 0, -1, 0};
+      const int direction_y[4] = {0, 1, 0, -1};
+      int x = (tile_count_x - 1) / 2;
+      int y = (tile_count_y - 1) / 2;
+      int direction = 0;
+      int leg_length = 1;
+      size_t total = size_t(tile_count_x) * tile_count_y;
+      tile_coordinates.push_back({x, y});
+      while (tile_coordinates.size() < total) {
+        for (int leg = 0; leg < 2; leg++) {
+          for (int step = 0; step < leg_length; step++) {
+            x += direction_x[direction];
+            y += direction_y[direction];
+            if (x >= 0 && x < tile_count_x && y >= 0 && y < tile_count_y) {
+              tile_coordinates.push_back({x, y});
+            }
+          }
+          direction = (direction + 1) % 4;
+        }
+        leg_length++;
+      }
+      break;
+    }
+  }
+
+  return tile_coordinates;
+}
+
+void Scene::WorkStealingSchedulingAlgorithm(
+    const std::shared_ptr<BaseCamera> camera, int camera_index) {
+  int tile_size = std::max(configuration_.strategies_.tile_size_, 1);
+  int tile_count_x = (camera->image_width_ + tile_size - 1) / tile_size;
+  int tile_count_y = (camera->image_height_ + tile_size - 1) / tile_size;
+  std::vector<Vec2i> tile_coordinates = OrderTiles(
+      tile_count_x, tile_count_y, configuration_.strategies_.tile_ordering_);
+
+  size_t worker_count = thread_pool_->Size();
+  bool packet_traversal = configuration_.acceleration_.packet_traversal_ &&
+                          configuration_.acceleration_.bvh_high_level_;
+  bool wavefront = configuration_.strategies_.ray_tracing_algorithm_ ==
+                   RayTracingAlgorithm::kWavefront;
+
+  // Tiles are dealt round robin, so every worker starts at the beginning of
+  // the ordering and the image fills in the requested order
+  std::vector<TileDeque> tile_deques(worker_count);
+  for (size_t i = 0; i < tile_coordinates.size(); i++) {
+    Tile tile;
+    tile.x_min = tile_coordinates[i].x * tile_size;
+    tile.y_min = tile_coordinates[i].y * tile_size;
+    tile.x_max = std::min(tile.x_min + tile_size, camera->image_width_);
+    tile.y_max = std::min(tile.y_min + tile_size, camera->image_height_);
+    tile_deques[i % worker_count].tiles_.push_back(tile);
+  }
+
+  auto render_tile = [&](const Tile& tile, std::vector<Ray>& rays,
+                         std::vector<HitRecord>& hits) {
+    for (int y = tile.y_min; y < tile.y_max; ++y) {
+      for (int x = tile.x_min; x < tile.x_max; ++x) {
+        int ray_count = camera->GenerateRays({x, y}, rays.data());
+        if (packet_traversal) {
+          IntersectPrimaryRays(rays.data(), ray_count, hits.data());
+        }
+        for (int ray_index = 0; ray_index < ray_count; ray_index++) {
+          if (timer.configuration_.timer_.ray_tracing_)
+            timer.AddTimeLog(Section::kRayTracing, Event::kStart, camera_index,
+                             y * camera->image_width_ + x, ray_index);
+          // Every sample has its own stream, so the path it traces does not
+          // depend on the other samples or on the thread tracing it
+          PCG32 random(pixel_seed({x, y}), ray_index + 1);
+          const Vec3f pixel_value = ray_tracing_algorithm_(
+              rays[ray_index], nullptr, max_recursion_depth_,
+              max_recursion_depth_, ray_index, random,
+              packet_traversal ? &hits[ray_index] : nullptr);
+          camera->UpdateSampledPixelValue({x, y}, pixel_value, ray_index,
+                                          rays[ray_index].diff_);
+          if (timer.configuration_.timer_.ray_tracing_)
+            timer.AddTimeLog(Section::kRayTracing, Event::kEnd, camera_index,
+                             y * camera->image_width_ + x, ray_index);
+        }
+      }
+    }
+  };
+
+  TaskGroup workers;
+  for (size_t i = 0; i < worker_count; i++) {
+    thread_pool_->Submit(workers, [&, i]() {
+      std::vector<Ray> rays(camera->mem_num_samples_);
+      std::vector<HitRecord> hits(camera->mem_num_samples_);
+      WavefrontQueues queues;
+      while (true) {
+        Tile tile;
+        bool found = false;
+        {
+          TileDeque& own = tile_deques[i];
+          std::lock_guard<std::mutex> lock(own.mutex_);
+          if (!own.tiles_.empty()) {
+            tile = own.tiles_.front();
+            own.tiles_.pop_front();
+            found = true;
+          }
+        }
+
+        // No tiles are added while rendering, so once every deque was seen
+        // empty the worker is done
+        for (size_t j = 1; !found && j < worker_count; j++) {
+          TileDeque& victim = tile_deques[(i + j) % worker_count];
+          std::lock_guard<std::mutex> lock(victim.mutex_);
+          if (!victim.tiles_.empty()) {
+            tile = victim.tiles_.back();
+            victim.tiles_.pop_back();
+            found = true;
+          }
+        }
+
+        if (!found) {
+          break;
+        }
+        if (wavefront) {
+          WavefrontRayTracingAlgorithm(camera, camera_index, tile, queues);
+        } else {
+          render_tile(tile, rays, hits);
+        }
+      }
+    });
+  }
+
+  thread_pool_->Wait(workers);
+}
\ No newline at end of file
@@ -1,7 +1,57 @@
 #include "SphereObject.hpp"
 
-std::shared_ptr<BoundingVolumeHierarchyElement> SphereObject::Intersect(
-    Ray& ray, float& t_hit, Vec3f& intersection_normal, bool, bool) const {
+#include <cmath>
+
+// Roots of |oc + t * direction| = radius for a unit direction in increasing
+// order, oc being the ray origin relative to the center. The discriminant
+// comes from the distance between the center and the ray line instead of
+// b^2 - c, which cancels out completely for small or far away spheres, and
+// the near root is recovered from the product of the roots.
+static bool IntersectSphere(const Vec3f& oc, const Vec3f& direction,
+                            float radius, float& t1, float& t2) {
+  float b = dot(oc, direction);
+  Vec3f perpendicular = oc - b * direction;
+  float radius_2 = radius * radius;
+  float discriminant = radius_2 - dot(perpendicular, perpendicular);
+
+  if (discriminant <= 0) {
+    return false;
+  }
+
+  float c = dot(oc, oc) - radius_2;
+  float q = -b - std::copysign(std::sqrt(discriminant), b);
+  t1 = c / q;
+  t2 = q;
+  if (t1 > t2) {
+    std::swap(t1, t2);
+  }
+  return true;
+}
+
+bool SphereObject::Intersect(const Ray& ray, HitRecord& hit, bool,
+                             bool) const {
+  float t1, t2;
+
+  // Rays have unit directions, so without a transform t already is the world
+  // space distance
+  if (identity_transform_) {
+    if (!IntersectSphere(ray.origin_ - center_, ray.direction_, radius_, t1,
+                         t2)) {
+      return false;
+    }
+    float t = t1 > 1e-5 ? t1 : t2;
+    if (t <= 1e-5 || t >= hit.t_) {
+      return false;
+    }
+    hit.t_ = t;
+    hit.primitive_id_ = 0;
+    hit.object_ = this;
+    hit.u_ = 0;
+    hit.v_ = 0;
+    hit.normal_ = (ray.origin_ + t * ray.direction_ - center_) / radius_;
+    return true;
+  }
+
   Vec3f transformed_ray_origin =
       inverse_transform_matrix_ * (ray.origin_ - motion_blur_ * ray.time_);
   Vec3f transformed_ray_destination =
@@ -12,80 +62,50 @@ std::shared_ptr<BoundingVolumeHierarchyElement> SphereObject::Intersect(
   Ray transformed_ray{ray.pixel_, transformed_ray_origin,
                       transformed_ray_direction, ray.diff_, ray.time_};
 
-  // Calculate the discriminant
-  Vec3f oc = transformed_ray.origin_ - center_;
-  float a = dot(transformed_ray.direction_, transformed_ray.direction_);
-  float b = 2.0f * dot(oc, transformed_ray.direction_);
-  float c = dot(oc, oc) - radius_ * radius_;
-  float discriminant = b * b - 4 * a * c;
-
-  // Check if the ray intersects with the sphere
-  if (discriminant > 0) {
-    // Find the closest intersection point
-    float t1 = (-b - sqrt(discriminant)) / (2.0f * a);
-    float t2 = (-b + sqrt(discriminant)) / (2.0f * a);
-    float t = t1 > 1e-5 ? t1 : t2;
-    if (t > 1e-5) {
-      Vec3f local_point =
-          transformed_ray.origin_ + t * transformed_ray.direction_;
-      Vec3f local_normal = normalize(local_point - center_);
-
-      float x = local_normal.x;
-      float y = local_normal.y;
-      float z = local_normal.z;
-      float r = sqrt(x * x + y * y + z * z);
-      float t = atan2(y, x);
-      float p = acos(z / r);
-
-      Vec3f local_normal_sample_1 =
-          Vec3f{float(sin(p + 0.05) * cos(t)), float(sin(p + 0.05) * sin(t)),
-                float(cos(p + 0.05))};
-      Vec3f local_normal_sample_2 =
-          Vec3f{float(sin(p - 0.05) * cos(t)), float(sin(p - 0.05) * sin(t)),
-                float(cos(p - 0.05))};
-      Vec3f local_normal_sample_3 =
-          Vec3f{float(sin(p) * cos(t + 0.05)), float(sin(p) * sin(t + 0.05)),
-                float(cos(p))};
-      Vec3f local_normal_sample_4 =
-          Vec3f{float(sin(p) * cos(t - 0.05)), float(sin(p) * sin(t - 0.05)),
-                float(cos(p))};
-
-      Vec3f local_point_sample_1 = center_ + radius_ * local_normal_sample_1;
-      Vec3f local_point_sample_2 = center_ + radius_ * local_normal_sample_2;
-      Vec3f local_point_sample_3 = center_ + radius_ * local_normal_sample_3;
-      Vec3f local_point_sample_4 = center_ + radius_ * local_normal_sample_4;
-
-      Vec3f global_point_sample_1 = transform_matrix_ * local_point_sample_1;
-      Vec3f global_point_sample_2 = transform_matrix_ * local_point_sample_2;
-      Vec3f global_point_sample_3 = transform_matrix_ * local_point_sample_3;
-      Vec3f global_point_sample_4 = transform_matrix_ * local_point_sample_4;
-
-      Vec3f first_axis_normal =
-          normalize(global_point_sample_1 - global_point_sample_2);
-      Vec3f second_axis_normal =
-          normalize(global_point_sample_3 - global_point_sample_4);
-
-      Vec3f approximated_normal =
-          normalize(cross(first_axis_normal, second_axis_normal));
-
-      Vec3f global_point = transform_matrix_ * local_point;
-      Vec3f diff = global_point - ray.origin_;
-      t_hit = norm(diff);
-      Vec3f normalized_diff = normalize(diff);
-      ray.direction_.x = normalized_diff.x;
-      ray.direction_.y = normalized_diff.y;
-      ray.direction_.z = normalized_diff.z;
-      intersection_normal = approximated_normal;
-      return std::dynamic_pointer_cast<BoundingVolumeHierarchyElement>(
-          std::const_pointer_cast<BaseObject>(this->shared_from_this()));
-    }
+  if (!IntersectSphere(transformed_ray.origin_ - center_,
+                       transformed_ray.direction_, radius_, t1, t2)) {
+    return false;
+  }
+  float t = t1 > 1e-5 ? t1 : t2;
+  if (t <= 1e-5) {
+    return false;
+  }
+
+  Vec3f local_point = transformed_ray.origin_ + t * transformed_ray.direction_;
+  Vec3f global_point = transform_matrix_ * local_point;
+  float t_hit = norm(global_point + motion_blur_ * ray.time_ - ray.origin_);
+  if (t_hit >= hit.t_) {
+    return false;
   }
+  hit.t_ = t_hit;
+  hit.primitive_id_ = 0;
+  hit.object_ = this;
+  hit.u_ = 0;
+  hit.v_ = 0;
+  // Normals transform with the inverse transpose of the object transform
+  hit.normal_ = normalize(transform_direction(
+      inverse_transpose_transform_matrix_, local_point - center_));
+  return true;
+}
+
+bool SphereObject::Occluded(const Ray& ray, float t_max) const {
+  Ray transformed_ray = TransformRayToObjectSpace(ray);
 
-  return nullptr;
+  // The object space direction is not unit length, the roots are scaled back
+  // by its length to stay in units of the ray direction
+  float length = norm(transformed_ray.direction_);
+  float t1, t2;
+  if (!IntersectSphere(transformed_ray.origin_ - center_,
+                       transformed_ray.direction_ / length, radius_, t1, t2)) {
+    return false;
+  }
+  t1 /= length;
+  t2 /= length;
+  return (t1 > 1e-5 && t1 < t_max) || (t2 > 1e-5 && t2 < t_max);
 }
 
 void SphereObject::Preprocess(bool high_level_bvh_enabled,
-                              bool low_level_bvh_enabled, bool) {
+                              bool low_level_bvh_enabled, bool, ThreadPool*) {
   if (high_level_bvh_enabled) {
     float x_min = center_.x - radius_;
     float y_min = center_.y - radius_;
@@ -112,22 +132,9 @@ void SphereObject::Preprocess(bool high_level_bvh_enabled,
     p6 = transform_matrix_ * p6;
     p7 = transform_matrix_ * p7;
 
-    Vec3f p0_motion = p0 + motion_blur_;
-    Vec3f p1_motion = p1 + motion_blur_;
-    Vec3f p2_motion = p2 + motion_blur_;
-    Vec3f p3_motion = p3 + motion_blur_;
-    Vec3f p4_motion = p4 + motion_blur_;
-    Vec3f p5_motion = p5 + motion_blur_;
-    Vec3f p6_motion = p6 + motion_blur_;
-    Vec3f p7_motion = p7 + motion_blur_;
-
-    Vec3f min_point = bounding_volume_min(
-        {p0, p1, p2, p3, p4, p5, p6, p7, p0_motion, p1_motion, p2_motion,
-         p3_motion, p4_motion, p5_motion, p6_motion, p7_motion});
-    Vec3f max_point = bounding_volume_max(
-        {p0, p1, p2, p3, p4, p5, p6, p7, p0_motion, p1_motion, p2_motion,
-         p3_motion, p4_motion, p5_motion, p6_motion, p7_motion});
-
-    InitializeSelf(min_point, max_point);
+    Vec3f min_point = bounding_volume_min({p0, p1, p2, p3, p4, p5, p6, p7});
+    Vec3f max_point = bounding_volume_max({p0, p1, p2, p3, p4, p5, p6, p7});
+
+    InitializeSelf(min_point, max_point, motion_blur_);
   }
 }
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+ThreadPool::ThreadPool(size_t thread_count, bool pin_threads) {
+  // Processors the process is allowed to run on, which may be fewer than the
+  // hardware has when it runs in a container or under taskset
+  std::vector<int> processors;
+#ifdef __linux__
+  cpu_set_t allowed_set;
+  CPU_ZERO(&allowed_set);
+  if (sched_getaffinity(0, sizeof(allowed_set), &allowed_set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &allowed_set)) {
+        processors.push_back(cpu);
+      }
+    }
+  }
+#endif
+  size_t processor_count = processors.size();
+  if (processor_count == 0) {
+    processor_count = std::thread::hardware_concurrency();
+    processor_count = processor_count > 0 ? processor_count : 8;
+  }
+  thread_count = thread_count > 0 ? thread_count : processor_count;
+
+  for (size_t i = 0; i < thread_count; i++) {
+    threads_.emplace_back(&ThreadPool::WorkerLoop, this);
+#ifdef __linux__
+    if (pin_threads && !processors.empty()) {
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(processors[i % processors.size()], &cpu_set);
+      if (pthread_setaffinity_np(threads_.back().native_handle(),
+                                 sizeof(cpu_set), &cpu_set) != 0) {
+        std::cout << "Could not pin the threads of the thread pool"
+                  << std::endl;
+        pin_threads = false;
+      }
+    }
+#endif
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  task_available_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::Submit(TaskGroup& group, std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back({std::move(task), &group});
+    group.pending_task_count_++;
+  }
+  task_available_.notify_one();
+}
+
+void ThreadPool::Wait(TaskGroup& group) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Sleeping only once no task of the group is queued keeps a waiting worker
+  // from blocking tasks that nobody else is free to run, tasks of other groups
+  // are left to the workers so they do not delay the caller
+  while (group.pending_task_count_ > 0) {
+    auto task = std::find_if(
+        tasks_.begin(), tasks_.end(),
+        [&group](const Task& queued) { return queued.group_ == &group; });
+    if (task != tasks_.end()) {
+      RunTask(lock, task);
+    } else {
+      group_finished_.wait(lock);
+    }
+  }
+}
+
+void ThreadPool::ParallelFor(int begin, int end, int chunk_size,
+                             const std::function<void(int)>& body) {
+  chunk_size = std::max(chunk_size, 1);
+  TaskGroup group;
+  for (int chunk_begin = begin; chunk_begin < end; chunk_begin += chunk_size) {
+    int chunk_end = std::min(chunk_begin + chunk_size, end);
+    Submit(group, [&body, chunk_begin, chunk_end]() {
+      for (int i = chunk_begin; i < chunk_end; i++) {
+        body(i);
+      }
+    });
+  }
+  Wait(group);
+}
+
+void ThreadPool::RunTask(std::unique_lock<std::mutex>& lock,
+                         std::deque<Task>::iterator task) {
+  Task running = std::move(*task);
+  tasks_.erase(task);
+  lock.unlock();
+  running.function_();
+  lock.lock();
+  if (--running.group_->pending_task_count_ == 0) {
+    group_finished_.notify_all();
+  }
+}
+
+void ThreadPool::WorkerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    task_available_.wait(lock,
+                         [this]() { return stopping_ || !tasks_.empty(); });
+    if (tasks_.empty()) {
+      return;
+    }
+    RunTask(lock, tasks_.begin());
+  }
+}
\ No newline at end of file
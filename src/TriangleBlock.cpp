@@ -0,0 +1,263 @@
+#include "TriangleBlock.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TRIANGLE_BLOCK_X86
+#endif
+
+// The kernels follow IntersectTriangle operation by operation and leave out
+// fused multiply-adds, so every lane gives the same hit as the scalar kernel.
+
+// Picks the closest of the hit lanes, the lowest lane wins ties
+static int ClosestLane(uint32_t hit_mask, const float* t, const float* u,
+                       const float* v, TriangleHit& hit) {
+  int closest_lane = -1;
+  for (; hit_mask; hit_mask &= hit_mask - 1) {
+    int lane = __builtin_ctz(hit_mask);
+    if (closest_lane < 0 || t[lane] < t[closest_lane]) {
+      closest_lane = lane;
+    }
+  }
+  if (closest_lane >= 0) {
+    hit.t_ = t[closest_lane];
+    hit.u_ = u[closest_lane];
+    hit.v_ = v[closest_lane];
+  }
+  return closest_lane;
+}
+
+#ifdef TRIANGLE_BLOCK_X86
+
+__attribute__((target("avx2"))) static int IntersectTriangleBlockAVX2(
+    const float* block, const Ray& ray, bool backface_culling,
+    float t_closest, TriangleHit& hit) {
+  const int width = 8;
+  __m256 v0_x = _mm256_loadu_ps(block + 0 * width);
+  __m256 v0_y = _mm256_loadu_ps(block + 1 * width);
+  __m256 v0_z = _mm256_loadu_ps(block + 2 * width);
+  __m256 edge1_x = _mm256_loadu_ps(block + 3 * width);
+  __m256 edge1_y = _mm256_loadu_ps(block + 4 * width);
+  __m256 edge1_z = _mm256_loadu_ps(block + 5 * width);
+  __m256 edge2_x = _mm256_loadu_ps(block + 6 * width);
+  __m256 edge2_y = _mm256_loadu_ps(block + 7 * width);
+  __m256 edge2_z = _mm256_loadu_ps(block + 8 * width);
+  __m256 direction_x = _mm256_set1_ps(ray.direction_.x);
+  __m256 direction_y = _mm256_set1_ps(ray.direction_.y);
+  __m256 direction_z = _mm256_set1_ps(ray.direction_.z);
+
+  __m256 ray_cross_e2_x = _mm256_sub_ps(_mm256_mul_ps(direction_y, edge2_z),
+                                        _mm256_mul_ps(direction_z, edge2_y));
+  __m256 ray_cross_e2_y = _mm256_sub_ps(_mm256_mul_ps(direction_z, edge2_x),
+                                        _mm256_mul_ps(direction_x, edge2_z));
+  __m256 ray_cross_e2_z = _mm256_sub_ps(_mm256_mul_ps(direction_x, edge2_y),
+                                        _mm256_mul_ps(direction_y, edge2_x));
+  __m256 det = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(edge1_x, ray_cross_e2_x),
+                    _mm256_mul_ps(edge1_y, ray_cross_e2_y)),
+      _mm256_mul_ps(edge1_z, ray_cross_e2_z));
+
+  __m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+  __m256 s_x = _mm256_sub_ps(_mm256_set1_ps(ray.origin_.x), v0_x);
+  __m256 s_y = _mm256_sub_ps(_mm256_set1_ps(ray.origin_.y), v0_y);
+  __m256 s_z = _mm256_sub_ps(_mm256_set1_ps(ray.origin_.z), v0_z);
+  __m256 u = _mm256_mul_ps(
+      inv_det, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(s_x, ray_cross_e2_x),
+                                           _mm256_mul_ps(s_y, ray_cross_e2_y)),
+                             _mm256_mul_ps(s_z, ray_cross_e2_z)));
+
+  __m256 s_cross_e1_x = _mm256_sub_ps(_mm256_mul_ps(s_y, edge1_z),
+                                      _mm256_mul_ps(s_z, edge1_y));
+  __m256 s_cross_e1_y = _mm256_sub_ps(_mm256_mul_ps(s_z, edge1_x),
+                                      _mm256_mul_ps(s_x, edge1_z));
+  __m256 s_cross_e1_z = _mm256_sub_ps(_mm256_mul_ps(s_x, edge1_y),
+                                      _mm256_mul_ps(s_y, edge1_x));
+  __m256 v = _mm256_mul_ps(
+      inv_det,
+      _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(direction_x, s_cross_e1_x),
+                                  _mm256_mul_ps(direction_y, s_cross_e1_y)),
+                    _mm256_mul_ps(direction_z, s_cross_e1_z)));
+  __m256 t = _mm256_mul_ps(
+      inv_det,
+      _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge2_x, s_cross_e1_x),
+                                  _mm256_mul_ps(edge2_y, s_cross_e1_y)),
+                    _mm256_mul_ps(edge2_z, s_cross_e1_z)));
+
+  __m256 zero = _mm256_setzero_ps();
+  __m256 one = _mm256_set1_ps(1.0f);
+  __m256 mask = _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ),
+                              _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+  mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+  mask = _mm256_and_ps(
+      mask, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+  mask = _mm256_and_ps(
+      mask, _mm256_cmp_ps(t, _mm256_set1_ps(1e-5f), _CMP_GT_OQ));
+  mask = _mm256_and_ps(
+      mask, _mm256_cmp_ps(t, _mm256_set1_ps(t_closest), _CMP_LT_OQ));
+  if (backface_culling) {
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(det, zero, _CMP_GE_OQ));
+  }
+
+  uint32_t hit_mask = _mm256_movemask_ps(mask);
+  if (!hit_mask) {
+    return -1;
+  }
+  float t_values[width], u_values[width], v_values[width];
+  _mm256_storeu_ps(t_values, t);
+  _mm256_storeu_ps(u_values, u);
+  _mm256_storeu_ps(v_values, v);
+  return ClosestLane(hit_mask, t_values, u_values, v_values, hit);
+}
+
+__attribute__((target("sse4.1"))) static int IntersectTriangleBlockSSE(
+    const float* block, const Ray& ray, bool backface_culling,
+    float t_closest, TriangleHit& hit) {
+  const int width = 4;
+  __m128 v0_x = _mm_loadu_ps(block + 0 * width);
+  __m128 v0_y = _mm_loadu_ps(block + 1 * width);
+  __m128 v0_z = _mm_loadu_ps(block + 2 * width);
+  __m128 edge1_x = _mm_loadu_ps(block + 3 * width);
+  __m128 edge1_y = _mm_loadu_ps(block + 4 * width);
+  __m128 edge1_z = _mm_loadu_ps(block + 5 * width);
+  __m128 edge2_x = _mm_loadu_ps(block + 6 * width);
+  __m128 edge2_y = _mm_loadu_ps(block + 7 * width);
+  __m128 edge2_z = _mm_loadu_ps(block + 8 * width);
+  __m128 direction_x = _mm_set1_ps(ray.direction_.x);
+  __m128 direction_y = _mm_set1_ps(ray.direction_.y);
+  __m128 direction_z = _mm_set1_ps(ray.direction_.z);
+
+  __m128 ray_cross_e2_x = _mm_sub_ps(_mm_mul_ps(direction_y, edge2_z),
+                                     _mm_mul_ps(direction_z, edge2_y));
+  __m128 ray_cross_e2_y = _mm_sub_ps(_mm_mul_ps(direction_z, edge2_x),
+                                     _mm_mul_ps(direction_x, edge2_z));
+  __m128 ray_cross_e2_z = _mm_sub_ps(_mm_mul_ps(direction_x, edge2_y),
+                                     _mm_mul_ps(direction_y, edge2_x));
+  __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1_x, ray_cross_e2_x),
+                                     _mm_mul_ps(edge1_y, ray_cross_e2_y)),
+                          _mm_mul_ps(edge1_z, ray_cross_e2_z));
+
+  __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+  __m128 s_x = _mm_sub_ps(_mm_set1_ps(ray.origin_.x), v0_x);
+  __m128 s_y = _mm_sub_ps(_mm_set1_ps(ray.origin_.y), v0_y);
+  __m128 s_z = _mm_sub_ps(_mm_set1_ps(ray.origin_.z), v0_z);
+  __m128 u = _mm_mul_ps(
+      inv_det, _mm_add_ps(_mm_add_ps(_mm_mul_ps(s_x, ray_cross_e2_x),
+                                     _mm_mul_ps(s_y, ray_cross_e2_y)),
+                          _mm_mul_ps(s_z, ray_cross_e2_z)));
+
+  __m128 s_cross_e1_x =
+      _mm_sub_ps(_mm_mul_ps(s_y, edge1_z), _mm_mul_ps(s_z, edge1_y));
+  __m128 s_cross_e1_y =
+      _mm_sub_ps(_mm_mul_ps(s_z, edge1_x), _mm_mul_ps(s_x, edge1_z));
+  __m128 s_cross_e1_z =
+      _mm_sub_ps(_mm_mul_ps(s_x, edge1_y), _mm_mul_ps(s_y, edge1_x));
+  __m128 v = _mm_mul_ps(
+      inv_det, _mm_add_ps(_mm_add_ps(_mm_mul_ps(direction_x, s_cross_e1_x),
+                                     _mm_mul_ps(direction_y, s_cross_e1_y)),
+                          _mm_mul_ps(direction_z, s_cross_e1_z)));
+  __m128 t = _mm_mul_ps(
+      inv_det, _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge2_x, s_cross_e1_x),
+                                     _mm_mul_ps(edge2_y, s_cross_e1_y)),
+                          _mm_mul_ps(edge2_z, s_cross_e1_z)));
+
+  __m128 zero = _mm_setzero_ps();
+  __m128 one = _mm_set1_ps(1.0f);
+  __m128 mask = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one));
+  mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+  mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+  mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, _mm_set1_ps(1e-5f)));
+  mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(t_closest)));
+  if (backface_culling) {
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(det, zero));
+  }
+
+  uint32_t hit_mask = _mm_movemask_ps(mask);
+  if (!hit_mask) {
+    return -1;
+  }
+  float t_values[width], u_values[width], v_values[width];
+  _mm_storeu_ps(t_values, t);
+  _mm_storeu_ps(u_values, u);
+  _mm_storeu_ps(v_values, v);
+  return ClosestLane(hit_mask, t_values, u_values, v_values, hit);
+}
+
+#endif
+
+// Lane by lane fallback for CPUs without SSE4.1
+static int IntersectTriangleBlockScalar(const float* block, int block_width,
+                                        const Ray& ray, bool backface_culling,
+                                        float t_closest, TriangleHit& hit) {
+  int closest_lane = -1;
+  for (int lane = 0; lane < block_width; lane++) {
+    Vec3f v0, edge1, edge2;
+    TriangleBlockLane(block, block_width, lane, v0, edge1, edge2);
+    TriangleHit lane_hit;
+    if (IntersectTriangleEdges(v0, edge1, edge2, ray, backface_culling,
+                               lane_hit) &&
+        lane_hit.t_ < t_closest) {
+      t_closest = lane_hit.t_;
+      hit = lane_hit;
+      closest_lane = lane;
+    }
+  }
+  return closest_lane;
+}
+
+static bool HasAVX2() {
+#ifdef TRIANGLE_BLOCK_X86
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+static bool HasSSE41() {
+#ifdef TRIANGLE_BLOCK_X86
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.1");
+#else
+  return false;
+#endif
+}
+
+static const bool kHasAVX2 = HasAVX2();
+static const bool kHasSSE41 = HasSSE41();
+
+int TriangleBlockWidth() { return kHasAVX2 ? 8 : 4; }
+
+void AppendTriangleBlock(const Vec3f* vertices, int block_width,
+                         std::vector<float>& blocks) {
+  size_t block_offset = blocks.size();
+  blocks.resize(block_offset + kTriangleBlockComponents * block_width);
+  float* block = blocks.data() + block_offset;
+  for (int lane = 0; lane < block_width; lane++) {
+    const Vec3f& v0 = vertices[3 * lane];
+    Vec3f edge1 = vertices[3 * lane + 1] - v0;
+    Vec3f edge2 = vertices[3 * lane + 2] - v0;
+    const float components[kTriangleBlockComponents] = {
+        v0.x,    v0.y,    v0.z,    edge1.x, edge1.y,
+        edge1.z, edge2.x, edge2.y, edge2.z};
+    for (int component = 0; component < kTriangleBlockComponents;
+         component++) {
+      block[component * block_width + lane] = components[component];
+    }
+  }
+}
+
+int IntersectTriangleBlock(const float* block, int block_width,
+                           const Ray& ray, bool backface_culling,
+                           float t_closest, TriangleHit& hit) {
+#ifdef TRIANGLE_BLOCK_X86
+  if (block_width == 8 && kHasAVX2) {
+    return IntersectTriangleBlockAVX2(block, ray, backface_culling, t_closest,
+                                      hit);
+  }
+  if (block_width == 4 && kHasSSE41) {
+    return IntersectTriangleBlockSSE(block, ray, backface_culling, t_closest,
+                                     hit);
+  }
+#endif
+  return IntersectTriangleBlockScalar(block, block_width, ray,
+                                      backface_culling, t_closest, hit);
+}
\ No newline at end of file
@@ -1,8 +1,26 @@
 #include "TriangleObject.hpp"
 
-std::shared_ptr<BoundingVolumeHierarchyElement> TriangleObject::Intersect(
-    Ray& ray, float& t_hit, Vec3f& intersection_normal, bool backface_culling,
-    bool) const {
+bool TriangleObject::Intersect(const Ray& ray, HitRecord& hit,
+                               bool backface_culling, bool) const {
+  TriangleHit triangle_hit;
+
+  // Rays have unit directions, so without a transform the kernel t already
+  // is the world space distance
+  if (identity_transform_) {
+    if (!IntersectTriangle(v0_, v1_, v2_, ray, backface_culling,
+                           triangle_hit) ||
+        triangle_hit.t_ >= hit.t_) {
+      return false;
+    }
+    hit.t_ = triangle_hit.t_;
+    hit.primitive_id_ = 0;
+    hit.object_ = this;
+    hit.u_ = triangle_hit.u_;
+    hit.v_ = triangle_hit.v_;
+    hit.normal_ = normal_;
+    return true;
+  }
+
   Vec3f transformed_ray_origin =
       inverse_transform_matrix_ * (ray.origin_ - motion_blur_ * ray.time_);
   Vec3f transformed_ray_destination =
@@ -13,56 +31,60 @@ std::shared_ptr<BoundingVolumeHierarchyElement> TriangleObject::Intersect(
   Ray transformed_ray{ray.pixel_, transformed_ray_origin,
                       transformed_ray_direction, ray.diff_, ray.time_};
 
-  if (backface_culling && dot(transformed_ray.direction_, normal_) > 0) {
-    return nullptr;
+  if (!IntersectTriangle(v0_, v1_, v2_, transformed_ray, backface_culling,
+                         triangle_hit)) {
+    return false;
   }
 
-  Vec3f edge1 = v1_ - v0_;
-  Vec3f edge2 = v2_ - v0_;
-  Vec3f ray_cross_e2 = cross(transformed_ray.direction_, edge2);
-  float det = dot(edge1, ray_cross_e2);
-
-  float inv_det = 1.0 / det;
-  Vec3f s = transformed_ray.origin_ - v0_;
-  float u = inv_det * dot(s, ray_cross_e2);
-
-  if (u < 0 || u > 1) {
-    return nullptr;
+  Vec3f local_point =
+      transformed_ray.origin_ + triangle_hit.t_ * transformed_ray.direction_;
+  Vec3f local_point_destination = local_point + normal_;
+  Vec3f global_point = transform_matrix_ * local_point;
+  float t_hit = norm(global_point + motion_blur_ * ray.time_ - ray.origin_);
+  if (t_hit >= hit.t_) {
+    return false;
   }
+  Vec3f global_point_destination = transform_matrix_ * local_point_destination;
+  hit.t_ = t_hit;
+  hit.primitive_id_ = 0;
+  hit.object_ = this;
+  hit.u_ = triangle_hit.u_;
+  hit.v_ = triangle_hit.v_;
+  hit.normal_ = normalize(global_point_destination - global_point);
+  return true;
+}
 
-  Vec3f s_cross_e1 = cross(s, edge1);
-  float v = inv_det * dot(transformed_ray.direction_, s_cross_e1);
-
-  if (v < 0 || u + v > 1) {
-    return nullptr;
+void TriangleObject::IntersectPacket(RayPacket& packet, uint32_t lane_mask,
+                                     HitRecord* hits,
+                                     bool backface_culling) const {
+  if (!identity_transform_) {
+    BaseObject::IntersectPacket(packet, lane_mask, hits, backface_culling);
+    return;
   }
 
-  float t = inv_det * dot(edge2, s_cross_e1);
-
-  if (t > 1e-5) {
-    Vec3f local_point =
-        transformed_ray.origin_ + t * transformed_ray.direction_;
-    Vec3f local_point_destination = local_point + normal_;
-    Vec3f global_point = transform_matrix_ * local_point;
-    Vec3f global_point_destination =
-        transform_matrix_ * local_point_destination;
-    Vec3f diff = global_point - ray.origin_;
-    t_hit = norm(diff);
-    Vec3f normalized_diff = normalize(diff);
-    ray.direction_.x = normalized_diff.x;
-    ray.direction_.y = normalized_diff.y;
-    ray.direction_.z = normalized_diff.z;
-    intersection_normal = normalize(global_point_destination - global_point);
-    return std::dynamic_pointer_cast<BoundingVolumeHierarchyElement>(
-        std::const_pointer_cast<BaseObject>(this->shared_from_this()));
-  } else {
-    return nullptr;
+  TriangleHit lane_hits[kRayPacketWidth];
+  uint32_t hit_mask = IntersectTrianglePacket(
+      v0_, v1_, v2_, packet, lane_mask, backface_culling, lane_hits);
+  for (uint32_t lanes = hit_mask; lanes; lanes &= lanes - 1) {
+    int lane = lowest_lane(lanes);
+    hits[lane].primitive_id_ = 0;
+    hits[lane].object_ = this;
+    hits[lane].u_ = lane_hits[lane].u_;
+    hits[lane].v_ = lane_hits[lane].v_;
+    hits[lane].normal_ = normal_;
   }
 }
 
+bool TriangleObject::Occluded(const Ray& ray, float t_max) const {
+  TriangleHit hit;
+  return IntersectTriangle(v0_, v1_, v2_, TransformRayToObjectSpace(ray),
+                           false, hit) &&
+         hit.t_ < t_max;
+}
+
 void TriangleObject::Preprocess(bool high_level_bvh_enabled,
                                 bool low_level_bvh_enabled,
-                                bool transform_enabled) {
+                                bool transform_enabled, ThreadPool*) {
   normal_ = normalize(cross(v1_ - v0_, v2_ - v0_));
 
   if (high_level_bvh_enabled || low_level_bvh_enabled) {
@@ -82,14 +104,7 @@ void TriangleObject::Preprocess(bool high_level_bvh_enabled,
     Vec3f p6 = Vec3f{x_min, y_max, z_max};
     Vec3f p7 = Vec3f{x_max, y_max, z_max};
 
-    Vec3f p0_motion = p0;
-    Vec3f p1_motion = p1;
-    Vec3f p2_motion = p2;
-    Vec3f p3_motion = p3;
-    Vec3f p4_motion = p4;
-    Vec3f p5_motion = p5;
-    Vec3f p6_motion = p6;
-    Vec3f p7_motion = p7;
+    Vec3f motion = {0, 0, 0};
 
     if (transform_enabled) {
       p0 = transform_matrix_ * p0;
@@ -101,23 +116,12 @@ void TriangleObject::Preprocess(bool high_level_bvh_enabled,
       p6 = transform_matrix_ * p6;
       p7 = transform_matrix_ * p7;
 
-      p0_motion = p0 + motion_blur_;
-      p1_motion = p1 + motion_blur_;
-      p2_motion = p2 + motion_blur_;
-      p3_motion = p3 + motion_blur_;
-      p4_motion = p4 + motion_blur_;
-      p5_motion = p5 + motion_blur_;
-      p6_motion = p6 + motion_blur_;
-      p7_motion = p7 + motion_blur_;
+      motion = motion_blur_;
     }
 
-    Vec3f min_point = bounding_volume_min(
-        {p0, p1, p2, p3, p4, p5, p6, p7, p0_motion, p1_motion, p2_motion,
-         p3_motion, p4_motion, p5_motion, p6_motion, p7_motion});
-    Vec3f max_point = bounding_volume_max(
-        {p0, p1, p2, p3, p4, p5, p6, p7, p0_motion, p1_motion, p2_motion,
-         p3_motion, p4_motion, p5_motion, p6_motion, p7_motion});
+    Vec3f min_point = bounding_volume_min({p0, p1, p2, p3, p4, p5, p6, p7});
+    Vec3f max_point = bounding_volume_max({p0, p1, p2, p3, p4, p5, p6, p7});
 
-    InitializeSelf(min_point, max_point);
+    InitializeSelf(min_point, max_point, motion);
   }
 }
\ No newline at end of file